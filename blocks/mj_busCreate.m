@@ -0,0 +1,14 @@
+function mj_busCreate(busNames, busStructs)
+% Copyright 2022-2023 The MathWorks, Inc.
+% Creates the buses of a model in the base workspace in one call.
+% Buses that already exist are not generated again.
+for i = 1:numel(busNames)
+    busName = busNames{i};
+    if evalin('base', strcat("exist('", busName, "', 'var')"))
+        continue;
+    end
+    busInfo = Simulink.Bus.createObject(busStructs{i});
+    assignin('base', busName, evalin('base', busInfo.busName));
+    evalin('base', strcat("clear('", busInfo.busName, "');"));
+end
+end
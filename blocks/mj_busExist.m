@@ -1,4 +0,0 @@
-function x = mj_busExist(busName)
-% Copyright 2022-2023 The MathWorks, Inc.
-    x=evalin('base', strcat("exist('", busName, "', 'var')"));
-end
\ No newline at end of file
@@ -100,24 +100,32 @@ catch
     mo.getDialogControl('depthBusText').Prompt = ['Depth Bus Type: ', 'NA'];
 end
 depthOutputOption = strcmp(get_param(mjBlk, 'depthOutOption'), 'on');
+% The S-Function converts depth to meters itself with the depthOutput=metric option
+sfunBlk = find_system(mjBlk, 'SearchDepth', 1, 'BlockType', 'S-Function');
+isMetricDepth = ~isempty(sfunBlk) && strcmp(getOption(get_param(sfunBlk{1}, 'Parameters'), 'depthOutput'), 'metric');
 
 if isempty(depthFieldnames) || ~depthOutputOption
     set_param(depthConverterPath, 'Commented', 'on');
     replacer(mjBlk, 'depth', 'simulink/Sinks/Terminator')
 else
-    set_param(depthConverterPath, 'Commented', 'off');
+    if isMetricDepth
+        set_param(depthConverterPath, 'Commented', 'through');
+    else
+        set_param(depthConverterPath, 'Commented', 'off');
+    end
     outportName = 'depth';
     replacer(mjBlk, 'depth', 'simulink/Sinks/Out1');
     set_param([mjBlk, '/', outportName], "Port", num2str(portIndex));
     portIndex = portIndex+1;
 end
 
-[znear, zfar] = mj_depth_near_far(xmlFile);
-set_param(mjBlk, 'znear', num2str(znear));
-set_param(mjBlk, 'zfar', num2str(zfar));
+% cached by mj_model_info when the buses were generated. the model is not loaded again
+info = mj_model_info(xmlFile);
+set_param(mjBlk, 'znear', num2str(info.znear));
+set_param(mjBlk, 'zfar', num2str(info.zfar));
 
 %% Sample Time
-sampleTime = mj_sampletime(xmlFile);
+sampleTime = info.sampleTime;
 set_param(mjBlk, 'sampleTime', num2str(sampleTime));
 
 mo.getDialogControl('sampleTimeText').Prompt = ['Sample Time: ', num2str(sampleTime)];
@@ -136,4 +144,20 @@ function replacer(blk, oldname, newtype)
         delete_block(oldpath);
         add_block(newtype, oldpath, 'Position', position);
     end
-end
\ No newline at end of file
+end
+
+function value = getOption(parameters, name)
+    % value of a name=value option in the S-Function parameter list, '' when it is not given.
+    % Same rules as getOptionString in mj_sfun.cpp: items are separated by , or ; and
+    % names and values are trimmed of spaces and tabs. The quotes of the char literal also end an item
+    value = '';
+    items = regexp(parameters, '[^,;'']*', 'match');
+    for index = 1:numel(items)
+        item = items{index};
+        separator = strfind(item, '=');
+        if ~isempty(separator) && strcmp(strtrim(item(1:separator(1)-1)), name)
+            value = strtrim(item(separator(1)+1:end));
+            return
+        end
+    end
+end
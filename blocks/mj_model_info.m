@@ -0,0 +1,13 @@
+function info = mj_model_info(xmlPath)
+% Copyright 2022-2023 The MathWorks, Inc.
+% Bus names, data lengths, sample time and depth clip planes of a model.
+% mj_model_info_mex runs in a separate process. It calls glfw functions which
+% work best in a main thread of a separate process. The process also keeps
+% the results of previous calls, so repeated mask initializations of the
+% same model do not load it again.
+persistent mh
+if ~(isa(mh,'matlab.mex.MexHost') && isvalid(mh))
+    mh = mexhost;
+end
+info = feval(mh, 'mj_model_info_mex', xmlPath);
+end
@@ -0,0 +1,203 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// CAMERA FRAME FILE
+// frameFileHeader, cameraCount x frameFileCamera, then the frames back to back.
+// Each frame is a frameRecordHeader followed by rgb (rgbLength bytes) and depth (depthLength floats),
+//  in the same layout as the block's rgb and depth outputs. All frames have the same size,
+//  so frame k starts at dataOffset + k*frameSize. Native byte order.
+
+#define FRAME_FILE_MAGIC "MJFRAMES"
+#define FRAME_FILE_VERSION 1
+#define FRAME_FILE_NAME_LENGTH 64
+
+struct frameFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t cameraCount;
+    uint32_t layout; // 0 - OpenGL order, 1 - MATLAB column major (cameraLayout option)
+    uint32_t reserved;
+    uint64_t rgbLength;
+    uint64_t depthLength;
+    uint64_t frameSize;
+    uint64_t dataOffset;
+    uint64_t frameCount; // written on close. readers should trust the file size after a crash
+};
+
+struct frameFileCamera
+{
+    char name[FRAME_FILE_NAME_LENGTH];
+    uint32_t height;
+    uint32_t width;
+};
+
+struct frameRecordHeader
+{
+    uint64_t index;
+    double time;
+};
+
+static_assert(sizeof(frameFileHeader) == 64, "frame file header must be packed");
+static_assert(sizeof(frameFileCamera) == 72, "frame file camera entry must be packed");
+static_assert(sizeof(frameRecordHeader) == 16, "frame record header must be packed");
+
+class frameRecorder
+{
+    // Appends camera frames to a frame file from a dedicated writer thread.
+    // The producer fills a preallocated frame and commits it. The writer thread streams committed frames
+    //  through a large stdio buffer (chunked writes). When all frames are in flight, the producer waits,
+    //  i.e. no frame is dropped and the disk sets the pace.
+
+    public:
+
+    struct frame
+    {
+        frameRecordHeader header;
+        std::vector<uint8_t> rgb;
+        std::vector<float> depth;
+    };
+
+    ~frameRecorder()
+    {
+        close();
+    }
+
+    bool open(const std::string &path, const std::vector<std::string> &names,
+        const std::vector<uint32_t> &heights, const std::vector<uint32_t> &widths, bool matlabLayout)
+    {
+        file = fopen(path.c_str(), "wb");
+        if(!file) return false;
+        setvbuf(file, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FRAME_FILE_MAGIC, sizeof(header.magic));
+        header.version = FRAME_FILE_VERSION;
+        header.cameraCount = static_cast<uint32_t>(names.size());
+        header.layout = matlabLayout ? 1 : 0;
+
+        std::vector<frameFileCamera> cameras(names.size());
+        for(size_t index=0; index<names.size(); index++)
+        {
+            memset(&cameras[index], 0, sizeof(frameFileCamera));
+            strncpy(cameras[index].name, names[index].c_str(), FRAME_FILE_NAME_LENGTH-1);
+            cameras[index].height = heights[index];
+            cameras[index].width = widths[index];
+            header.rgbLength += 3*static_cast<uint64_t>(heights[index])*widths[index];
+            header.depthLength += static_cast<uint64_t>(heights[index])*widths[index];
+        }
+        header.frameSize = sizeof(frameRecordHeader) + header.rgbLength + sizeof(float)*header.depthLength;
+        header.dataOffset = sizeof(frameFileHeader) + sizeof(frameFileCamera)*cameras.size();
+
+        fwrite(&header, sizeof(header), 1, file);
+        if(!cameras.empty()) fwrite(cameras.data(), sizeof(frameFileCamera), cameras.size(), file);
+
+        for(auto &item: frames)
+        {
+            item.rgb.resize(header.rgbLength);
+            item.depth.resize(header.depthLength);
+        }
+        writer = std::thread(&frameRecorder::writerLoop, this);
+        return true;
+    }
+
+    // Producer side. acquireFrame waits for a free frame. Fill rgb/depth and commit it.
+    frame *acquireFrame()
+    {
+        std::unique_lock<std::mutex> locker(mut);
+        cv.wait(locker, [this](){ return inFlight < FRAME_COUNT;});
+        return &frames[(next + inFlight) % FRAME_COUNT];
+    }
+
+    void commitFrame(frame *item, double time)
+    {
+        item->header.index = committed;
+        item->header.time = time;
+        {
+            std::lock_guard<std::mutex> locker(mut);
+            inFlight++;
+            committed++;
+        }
+        cv.notify_all();
+    }
+
+    // Writes the remaining frames and closes the file
+    void close()
+    {
+        if(!file) return;
+        {
+            std::lock_guard<std::mutex> locker(mut);
+            stop = true;
+        }
+        cv.notify_all();
+        if(writer.joinable()) writer.join();
+
+        header.frameCount = written;
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+        file = NULL;
+    }
+
+    bool isOpen()
+    {
+        return file != NULL;
+    }
+
+    uint64_t framesWritten()
+    {
+        return written;
+    }
+
+    private:
+    static constexpr unsigned FRAME_COUNT = 4;
+    static constexpr size_t WRITE_BUFFER_SIZE = 1 << 22;
+
+    void writerLoop()
+    {
+        while(1)
+        {
+            frame *item;
+            {
+                std::unique_lock<std::mutex> locker(mut);
+                cv.wait(locker, [this](){ return stop || inFlight > 0;});
+                if(inFlight == 0) break; // stopped and drained
+                item = &frames[next];
+            }
+
+            // the frame is owned by the writer until it is released below
+            fwrite(&item->header, sizeof(frameRecordHeader), 1, file);
+            fwrite(item->rgb.data(), 1, item->rgb.size(), file);
+            fwrite(item->depth.data(), sizeof(float), item->depth.size(), file);
+            written++;
+
+            {
+                std::lock_guard<std::mutex> locker(mut);
+                next = (next + 1) % FRAME_COUNT;
+                inFlight--;
+            }
+            cv.notify_all();
+        }
+    }
+
+    FILE *file = NULL;
+    frameFileHeader header;
+    frame frames[FRAME_COUNT];
+    std::thread writer;
+
+    std::mutex mut;
+    std::condition_variable cv;
+    unsigned next = 0; // oldest committed frame
+    unsigned inFlight = 0; // committed and not written yet
+    uint64_t committed = 0; // producer only
+    uint64_t written = 0; // writer only until close
+    bool stop = false;
+};
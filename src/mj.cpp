@@ -1,9 +1,30 @@
 // Copyright 2022-2023 The MathWorks, Inc.
 #include "mj.hpp"
+#include "tracer.hpp"
 #include <iostream>
 #include <stdlib.h>
 #include <string.h> 
 #include <fstream>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <chrono>
+#include <map>
+
+// camera layout kernels (SSE2 is part of every x86-64 target)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MJ_LAYOUT_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef MJ_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef MJ_OSMESA
+#include <GL/osmesa.h>
+#endif
 
 // STATIC AND GLOBALS
 
@@ -21,11 +42,277 @@ using std::shared_ptr;
 #define MALLOC(buf, alignment) malloc(buf)
 #define FREE(buf) free(buf)
 
+// MODEL CACHE --------------------------------------------------------------------
+// Compiled models (MJB) are cached on disk. The key is a hash of the MuJoCo version, the XML files (incl. <include>)
+//  and every file the model references (meshes, textures, ...). Any content change gives a new key.
+//  Stale entries age out through the size cap (least recently used first).
+// MJ_MODEL_CACHE_DIR overrides the location (default: <temp>/mujoco_simulink_cache).
+// MJ_MODEL_CACHE_MB sets the size cap in MB (default 2048). 0 disables the cache.
+// No exceptions are thrown (error_code overloads). Any cache failure falls back to mj_loadXML.
+namespace fs = std::filesystem;
+
+#define MODEL_CACHE_DEFAULT_MB 2048
+
+static void hashBytes(uint64_t &hash, const char *data, size_t length)
+{
+    // FNV-1a
+    for(size_t index=0; index<length; index++)
+    {
+        hash ^= static_cast<unsigned char>(data[index]);
+        hash *= 0x100000001b3ULL;
+    }
+}
+
+static bool readText(const fs::path &path, std::string &text)
+{
+    std::ifstream file(path, std::ios::binary);
+    if(!file) return false;
+    text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static void hashFile(uint64_t &hash, const fs::path &path)
+{
+    std::string name = path.generic_string();
+    hashBytes(hash, name.c_str(), name.size()+1);
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<char> chunk(1 << 20);
+    while(file)
+    {
+        file.read(chunk.data(), chunk.size());
+        hashBytes(hash, chunk.data(), static_cast<size_t>(file.gcount()));
+    }
+}
+
+// name="value" attributes with the tag they belong to. MJCF is simple enough that no XML parser is needed
+struct xmlAttribute
+{
+    std::string tag;
+    std::string name;
+    std::string value;
+};
+
+static std::vector<xmlAttribute> findFileAttributes(const std::string &xml)
+{
+    static const char *names[] = {"file", "fileright", "fileleft", "fileup", "filedown", "filefront", "fileback",
+        "assetdir", "meshdir", "texturedir"};
+    std::vector<xmlAttribute> attributes;
+    for(const char *name: names)
+    {
+        std::string key = std::string(name) + "=";
+        size_t position = xml.find(key);
+        while(position != std::string::npos)
+        {
+            size_t valueStart = position + key.size();
+            bool isWholeName = (position > 0 && isspace(static_cast<unsigned char>(xml[position-1])));
+            if(isWholeName && valueStart < xml.size() && (xml[valueStart] == '"' || xml[valueStart] == '\''))
+            {
+                size_t valueEnd = xml.find(xml[valueStart], valueStart+1);
+                size_t tagStart = xml.rfind('<', position);
+                if(valueEnd != std::string::npos && tagStart != std::string::npos)
+                {
+                    size_t tagEnd = xml.find_first_of(" \t\r\n/>", tagStart+1);
+                    attributes.push_back({xml.substr(tagStart+1, tagEnd-tagStart-1), name,
+                        xml.substr(valueStart+1, valueEnd-valueStart-1)});
+                }
+            }
+            position = xml.find(key, position+1);
+        }
+    }
+    return attributes;
+}
+
+static void collectModelFiles(const fs::path &xmlPath, const fs::path &modelDir, std::vector<fs::path> &xmlFiles, std::vector<std::string> &texts)
+{
+    // includes are resolved relative to the directory of the main model file
+    for(auto &existing: xmlFiles)
+    {
+        if(existing == xmlPath) return;
+    }
+    std::string text;
+    if(!readText(xmlPath, text)) return;
+    xmlFiles.push_back(xmlPath);
+    texts.push_back(text);
+
+    for(auto &attribute: findFileAttributes(text))
+    {
+        if(attribute.tag == "include" && attribute.name == "file")
+        {
+            fs::path include(attribute.value);
+            collectModelFiles(include.is_absolute() ? include : modelDir/include, modelDir, xmlFiles, texts);
+        }
+    }
+}
+
+bool modelContentHash(const std::string &file, uint64_t &hash)
+{
+    std::error_code ec;
+    fs::path xmlPath = fs::absolute(fs::path(file), ec);
+    if(ec) return false;
+    fs::path modelDir = xmlPath.parent_path();
+
+    std::vector<fs::path> xmlFiles;
+    std::vector<std::string> texts;
+    collectModelFiles(xmlPath, modelDir, xmlFiles, texts);
+    if(xmlFiles.empty()) return false;
+
+    hash = 0xcbf29ce484222325ULL;
+    std::string version = std::to_string(mj_version()) + "." + std::to_string(mjVERSION_HEADER);
+    hashBytes(hash, version.c_str(), version.size());
+    for(size_t index=0; index<xmlFiles.size(); index++)
+    {
+        std::string name = xmlFiles[index].generic_string();
+        hashBytes(hash, name.c_str(), name.size()+1);
+        hashBytes(hash, texts[index].c_str(), texts[index].size());
+    }
+
+    // asset directories (compiler attributes may be in any of the files). meshdir/texturedir default to assetdir
+    fs::path assetDir, meshDir, textureDir;
+    for(auto &text: texts)
+    {
+        for(auto &attribute: findFileAttributes(text))
+        {
+            if(attribute.tag != "compiler") continue;
+            if(attribute.name == "assetdir") assetDir = attribute.value;
+            if(attribute.name == "meshdir") meshDir = attribute.value;
+            if(attribute.name == "texturedir") textureDir = attribute.value;
+        }
+    }
+    if(meshDir.empty()) meshDir = assetDir;
+    if(textureDir.empty()) textureDir = assetDir;
+
+    for(auto &text: texts)
+    {
+        for(auto &attribute: findFileAttributes(text))
+        {
+            if(attribute.name.compare(0, 4, "file") != 0 || attribute.tag == "include") continue;
+
+            fs::path asset(attribute.value);
+            if(!asset.is_absolute())
+            {
+                fs::path dir = modelDir;
+                if(attribute.tag == "mesh" || attribute.tag == "skin" || attribute.tag == "hfield") dir /= meshDir;
+                else if(attribute.tag == "texture") dir /= textureDir;
+                asset = dir/asset;
+            }
+            hashFile(hash, asset);
+        }
+    }
+    return true;
+}
+
+static size_t modelCacheLimit()
+{
+    const char *limit = getenv("MJ_MODEL_CACHE_MB");
+    double megabytes = limit ? strtod(limit, NULL) : MODEL_CACHE_DEFAULT_MB;
+    return (megabytes > 0) ? static_cast<size_t>(megabytes*1024*1024) : 0;
+}
+
+static fs::path modelCacheDir()
+{
+    const char *dir = getenv("MJ_MODEL_CACHE_DIR");
+    if(dir && dir[0] != '\0') return fs::path(dir);
+    std::error_code ec;
+    return fs::temp_directory_path(ec)/"mujoco_simulink_cache";
+}
+
+static void evictModelCache(const fs::path &dir, size_t limit)
+{
+    std::error_code ec;
+    std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+    size_t total = 0;
+    for(fs::directory_iterator entry(dir, ec); !ec && entry != fs::directory_iterator(); entry.increment(ec))
+    {
+        if(entry->path().extension() != ".mjb") continue;
+        total += static_cast<size_t>(entry->file_size(ec));
+        entries.push_back({entry->last_write_time(ec), entry->path()});
+    }
+    std::sort(entries.begin(), entries.end());
+    for(auto &entry: entries)
+    {
+        if(total <= limit) break;
+        size_t size = static_cast<size_t>(fs::file_size(entry.second, ec));
+        if(fs::remove(entry.second, ec)) total -= size;
+    }
+}
+
+static mjModel *loadModelCached(const std::string &file, char *err, int errLength)
+{
+    size_t limit = modelCacheLimit();
+    uint64_t key = 0;
+    if(limit == 0 || !modelContentHash(file, key)) return mj_loadXML(file.c_str(), 0, err, errLength);
+
+    char keyStr[17];
+    snprintf(keyStr, sizeof(keyStr), "%016llx", static_cast<unsigned long long>(key));
+    fs::path dir = modelCacheDir();
+    fs::path entry = dir/(std::string(keyStr) + ".mjb");
+
+    std::error_code ec;
+    if(fs::exists(entry, ec))
+    {
+        mjModel *cached = mj_loadModel(entry.string().c_str(), NULL);
+        if(cached)
+        {
+            fs::last_write_time(entry, fs::file_time_type::clock::now(), ec); // most recently used
+            return cached;
+        }
+        fs::remove(entry, ec); // unreadable entry. compile again
+    }
+
+    mjModel *model = mj_loadXML(file.c_str(), 0, err, errLength);
+    if(!model) return NULL;
+
+    // write to a unique name and rename, so that concurrent sessions never read a partial file
+    fs::create_directories(dir, ec);
+    auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+    fs::path temporary = dir/(std::string(keyStr) + "." + std::to_string(stamp) + ".tmp");
+    mj_saveModel(model, temporary.string().c_str(), NULL, 0);
+    fs::rename(temporary, entry, ec);
+    if(ec) fs::remove(temporary, ec);
+    evictModelCache(dir, limit);
+    return model;
+}
+
+// MODEL REGISTRY -----------------------------------------------------------------
+// mjModel is never modified after loading, so all the instances of a file share one (e.g. for each subsystems).
+// Each instance owns only its mjData. The model is deleted with its last instance.
+static std::mutex modelRegistryMutex;
+static std::map<std::string, std::weak_ptr<mjModel>> modelRegistry;
+
+static std::shared_ptr<mjModel> acquireModel(const std::string &file, char *err, int errLength)
+{
+    std::error_code ec;
+    std::string key = fs::weakly_canonical(fs::path(file), ec).string();
+    if(ec) key = file;
+
+    std::lock_guard<std::mutex> lock(modelRegistryMutex);
+    for(auto entry = modelRegistry.begin(); entry != modelRegistry.end(); )
+    {
+        if(entry->second.expired()) entry = modelRegistry.erase(entry);
+        else entry++;
+    }
+
+    // the last owner may have released the model since the sweep above. it is loaded again then
+    auto found = modelRegistry.find(key);
+    if(found != modelRegistry.end())
+    {
+        if(auto model = found->second.lock()) return model;
+    }
+
+    mjModel *model = loadModelCached(file, err, errLength);
+    if(!model) return nullptr;
+    std::shared_ptr<mjModel> shared(model, mj_deleteModel);
+    modelRegistry[key] = shared;
+    return shared;
+}
+
 // MODEL --------------------------------------------------------------------------
 int MujocoModelInstance::initMdl(std::string file, bool shouldInitCam, bool shouldGetCami)
 {
     char err[1000] = "err";
-    m = mj_loadXML(file.c_str(), 0, err, 1000);
+    sharedModel = acquireModel(file, err, 1000);
+    m = sharedModel.get();
     if (!m) 
     {
         return -1;
@@ -51,9 +338,34 @@ int MujocoModelInstance::initMdl(std::string file, bool shouldInitCam, bool shou
     return errCode;
 }
 
+// Tallest framebuffer the atlas may use. Lower than GL_MAX_RENDERBUFFER_SIZE on any desktop GPU or Mesa
+#define ATLAS_MAX_HEIGHT 8192
+
 int MujocoModelInstance::initCameras()
 {
     int ncams = m->ncam;
+    if(cameraAtlas && ncams > 1 && ncams*m->vis.global.offheight <= ATLAS_MAX_HEIGHT)
+    {
+        // one offscreen object renders all the cameras
+        offscreenCam.push_back(std::make_shared<MujocoGUI>());
+        if(offscreenCam[0]->init(this, MJ_OFFSCREEN) != NO_ERR)
+        {
+            return -2;
+        }
+        offscreenCam[0]->backend = offscreenBackend;
+        offscreenCam[0]->asyncReadback = cameraAsyncReadback;
+        offscreenCam[0]->metricDepth = cameraMetricDepth;
+        offscreenCam[0]->pointCloud = cameraPointCloud;
+        offscreenCam[0]->camType = mjCAMERA_FIXED;
+        offscreenCam[0]->camId = 0;
+        for(int camIndex=0; camIndex<ncams; camIndex++)
+        {
+            offscreenCam[0]->atlasCamIds.push_back(camIndex);
+            offscreenCam[0]->crops.push_back(getCameraCrop(camIndex));
+        }
+        return 0;
+    }
+
     for(int camIndex=0; camIndex<ncams; camIndex++)
     {
         offscreenCam.push_back(std::make_shared<MujocoGUI>());
@@ -65,24 +377,142 @@ int MujocoModelInstance::initCameras()
             return -2;
         }
 
+        offscreenCam[camIndex]->backend = offscreenBackend;
+        offscreenCam[camIndex]->asyncReadback = cameraAsyncReadback;
+        offscreenCam[camIndex]->metricDepth = cameraMetricDepth;
+        offscreenCam[camIndex]->pointCloud = cameraPointCloud;
         offscreenCam[camIndex]->camType = mjCAMERA_FIXED; // only handling fixed type camera now. assuming all cameras in xml as fixed type!
         offscreenCam[camIndex]->camId = camIndex;
+        offscreenCam[camIndex]->crops.push_back(getCameraCrop(camIndex));
     }
     return 0;
 }
 
+cameraCrop MujocoModelInstance::getCameraCrop(int camId)
+{
+    // full image unless the model has custom fields for this camera
+    cameraCrop crop;
+    unsigned W = m->vis.global.offwidth;
+    unsigned H = m->vis.global.offheight;
+    crop.width = W;
+    crop.height = H;
+
+    std::string camName(m->names + m->name_camadr[camId]);
+    int roiId = mj_name2id(m, mjOBJ_NUMERIC, ("camera_roi_" + camName).c_str());
+    if(roiId >= 0 && m->numeric_size[roiId] == 4)
+    {
+        const mjtNum *roi = m->numeric_data + m->numeric_adr[roiId];
+        crop.x = static_cast<unsigned>(std::min(std::max(roi[0], 0.0), W-1.0));
+        crop.y = static_cast<unsigned>(std::min(std::max(roi[1], 0.0), H-1.0));
+        crop.width = static_cast<unsigned>(std::min(std::max(roi[2], 1.0), 1.0*(W-crop.x)));
+        crop.height = static_cast<unsigned>(std::min(std::max(roi[3], 1.0), 1.0*(H-crop.y)));
+    }
+
+    int factorId = mj_name2id(m, mjOBJ_NUMERIC, ("camera_downsample_" + camName).c_str());
+    if(factorId >= 0 && m->numeric_size[factorId] >= 1)
+    {
+        mjtNum factor = m->numeric_data[m->numeric_adr[factorId]];
+        crop.factor = static_cast<unsigned>(std::min(std::max(factor, 1.0), 1.0*std::min(crop.width, crop.height)));
+    }
+    return crop;
+}
+
 int MujocoModelInstance::initData()
 {
     char err[1000] = "err";
     d = mj_makeData(m);
     if(!d) return -1;
-    else return 0;
+
+    // preallocate so that stepping does not allocate
+    ctrlTarget.assign(m->nu, 0);
+    ctrlPrevious.assign(m->nu, 0);
+    hasPreviousCtrl = false;
+
+    renderData = mj_makeData(m);
+    if(!renderData) return -1;
+    for(unsigned index=0; index<3; index++)
+    {
+        visualState &state = visualBuffer.slot(index);
+        state.qpos.assign(m->nq, 0);
+        state.mocap_pos.assign(3*m->nmocap, 0);
+        state.mocap_quat.assign(4*m->nmocap, 0);
+        state.ctrl.assign(m->nu, 0);
+        state.act.assign(m->na, 0);
+    }
+    publishVisualState(); // initial state for the renderer
+    return 0;
+}
+
+// operating point vector: version, state size, nu, lastRenderTime, hasPreviousCtrl, ctrlPrevious (nu), ctrlTarget (nu), state
+#define OPERATING_POINT_VERSION 1
+#define OPERATING_POINT_HEADER 5
+#define OPERATING_POINT_STATE mjSTATE_INTEGRATION
+
+std::vector<double> MujocoModelInstance::getOperatingPoint()
+{
+    std::lock_guard<std::mutex> lock(dMutex);
+    int stateSize = mj_stateSize(m, OPERATING_POINT_STATE);
+    unsigned nu = m->nu;
+
+    std::vector<double> point(OPERATING_POINT_HEADER + 2*nu + stateSize);
+    point[0] = OPERATING_POINT_VERSION;
+    point[1] = stateSize;
+    point[2] = nu;
+    point[3] = lastRenderTime;
+    point[4] = hasPreviousCtrl ? 1 : 0;
+    memcpy(&point[OPERATING_POINT_HEADER], ctrlPrevious.data(), nu*sizeof(mjtNum));
+    memcpy(&point[OPERATING_POINT_HEADER + nu], ctrlTarget.data(), nu*sizeof(mjtNum));
+    mj_getState(m, d, &point[OPERATING_POINT_HEADER + 2*nu], OPERATING_POINT_STATE);
+    return point;
+}
+
+int MujocoModelInstance::setOperatingPoint(const double *point, size_t length)
+{
+    {
+        std::lock_guard<std::mutex> lock(dMutex);
+        int stateSize = mj_stateSize(m, OPERATING_POINT_STATE);
+        unsigned nu = m->nu;
+        if(length != OPERATING_POINT_HEADER + 2*nu + stateSize || point[0] != OPERATING_POINT_VERSION ||
+            point[1] != stateSize || point[2] != nu)
+        {
+            return -1;
+        }
+
+        lastRenderTime = point[3];
+        hasPreviousCtrl = (point[4] != 0);
+        memcpy(ctrlPrevious.data(), &point[OPERATING_POINT_HEADER], nu*sizeof(mjtNum));
+        memcpy(ctrlTarget.data(), &point[OPERATING_POINT_HEADER + nu], nu*sizeof(mjtNum));
+        mj_setState(m, d, &point[OPERATING_POINT_HEADER + 2*nu], OPERATING_POINT_STATE);
+        mj_forward(m, d); // derived quantities (sensors, kinematics) of the restored state
+        hasLastCameraState = false;
+    }
+    for(auto &cam: offscreenCam) cam->discardPendingReadback = true;
+    publishVisualState();
+    return 0;
+}
+
+void MujocoModelInstance::resetState()
+{
+    {
+        std::lock_guard<std::mutex> lock(dMutex);
+        mj_resetData(m, d);
+        std::fill(ctrlTarget.begin(), ctrlTarget.end(), 0);
+        std::fill(ctrlPrevious.begin(), ctrlPrevious.end(), 0);
+        hasPreviousCtrl = false;
+        lastRenderTime = 0;
+        hasLastCameraState = false;
+        cameraSkipCount = 0;
+    }
+    for(auto &cam: offscreenCam) cam->discardPendingReadback = true;
+    publishVisualState();
 }
 
 MujocoModelInstance::~MujocoModelInstance()
 {
-    mj_deleteModel(m);
+    mj_deleteData(cameraRenderData);
+    mj_deleteData(renderData);
     mj_deleteData(d);
+    // the model is deleted by the registry once its last instance is gone
 }
 
 mjModel *MujocoModelInstance::get_m()
@@ -90,167 +520,1259 @@ mjModel *MujocoModelInstance::get_m()
     return m;
 }
 
-mjData *MujocoModelInstance::get_d()
+mjData *MujocoModelInstance::get_d()
+{
+    return d;
+}
+
+mjData *MujocoModelInstance::getRenderData()
+{
+    if(visualBuffer.fetch() || isRenderDataStale)
+    {
+        loadVisualState(visualBuffer.readBuffer(), renderData);
+        isRenderDataStale = false;
+    }
+    return renderData;
+}
+
+void MujocoModelInstance::publishVisualState()
+{
+    // called by the (single) thread that steps this instance
+    storeVisualState(visualBuffer.writeBuffer());
+    visualBuffer.publish();
+}
+
+void MujocoModelInstance::storeVisualState(visualState &state)
+{
+    state.time = d->time;
+    memcpy(state.qpos.data(), d->qpos, m->nq*sizeof(mjtNum));
+    memcpy(state.mocap_pos.data(), d->mocap_pos, 3*m->nmocap*sizeof(mjtNum));
+    memcpy(state.mocap_quat.data(), d->mocap_quat, 4*m->nmocap*sizeof(mjtNum));
+    memcpy(state.ctrl.data(), d->ctrl, m->nu*sizeof(mjtNum));
+    memcpy(state.act.data(), d->act, m->na*sizeof(mjtNum));
+}
+
+void MujocoModelInstance::loadVisualState(const visualState &state, mjData *data)
+{
+    data->time = state.time;
+    memcpy(data->qpos, state.qpos.data(), m->nq*sizeof(mjtNum));
+    memcpy(data->mocap_pos, state.mocap_pos.data(), 3*m->nmocap*sizeof(mjtNum));
+    memcpy(data->mocap_quat, state.mocap_quat.data(), 4*m->nmocap*sizeof(mjtNum));
+    memcpy(data->ctrl, state.ctrl.data(), m->nu*sizeof(mjtNum));
+    memcpy(data->act, state.act.data(), m->na*sizeof(mjtNum));
+
+    // subset of mj_fwdPosition needed for visualization. no collision or constraint solve:
+    //  contacts and contact forces are not in the snapshot (see README)
+    mj_kinematics(m, data);
+    mj_comPos(m, data);
+    mj_camlight(m, data);
+    mj_tendon(m, data);
+}
+
+int MujocoModelInstance::enableCameraPipeline()
+{
+    cameraRenderData = mj_makeData(m);
+    if(!cameraRenderData) return -1;
+    cameraState.qpos.assign(m->nq, 0);
+    cameraState.mocap_pos.assign(3*m->nmocap, 0);
+    cameraState.mocap_quat.assign(4*m->nmocap, 0);
+    cameraState.ctrl.assign(m->nu, 0);
+    cameraState.act.assign(m->na, 0);
+    cameraPipelined = true;
+    return 0;
+}
+
+void MujocoModelInstance::captureCameraState()
+{
+    // Physics moves on while a pipelined render is in flight. Pin the state that was requested.
+    // Synchronous renders simply use the latest published state (physics waits for them).
+    if(cameraPipelined)
+    {
+        storeVisualState(cameraState);
+        cameraStateCaptured++;
+    }
+}
+
+mjData *MujocoModelInstance::getCameraRenderData()
+{
+    if(!cameraPipelined) return getRenderData();
+
+    // every camera of this instance renders the same request. Rebuild kinematics only once per request
+    if(cameraStateLoaded != cameraStateCaptured)
+    {
+        loadVisualState(cameraState, cameraRenderData);
+        cameraStateLoaded = cameraStateCaptured;
+    }
+    return cameraRenderData;
+}
+
+static bool isStateNear(const std::vector<mjtNum> &a, const std::vector<mjtNum> &b, mjtNum tolerance)
+{
+    for(size_t index=0; index<a.size(); index++)
+    {
+        if(std::abs(a[index] - b[index]) > tolerance) return false;
+    }
+    return true;
+}
+
+bool MujocoModelInstance::shouldRenderCameras()
+{
+    if(!cameraSkipUnchanged) return true;
+
+    // the state this request renders. Only fetched here. kinematics are rebuilt later, and only if a render follows
+    const visualState *state = &cameraState;
+    if(!cameraPipelined)
+    {
+        if(visualBuffer.fetch()) isRenderDataStale = true;
+        state = &visualBuffer.readBuffer();
+    }
+
+    if(hasLastCameraState &&
+       isStateNear(state->qpos, lastCameraState.qpos, cameraChangeTolerance) &&
+       isStateNear(state->mocap_pos, lastCameraState.mocap_pos, cameraChangeTolerance) &&
+       isStateNear(state->mocap_quat, lastCameraState.mocap_quat, cameraChangeTolerance))
+    {
+        cameraSkipCount++;
+        return false;
+    }
+
+    // sizes never change, so the copy does not allocate after the first one
+    lastCameraState.qpos = state->qpos;
+    lastCameraState.mocap_pos = state->mocap_pos;
+    lastCameraState.mocap_quat = state->mocap_quat;
+    hasLastCameraState = true;
+    return true;
+}
+
+double MujocoModelInstance::getSampleTime()
+{
+    return m->opt.timestep;
+}
+
+sensorInterface MujocoModelInstance::getSensorInterface()
+{
+    sensorInterface si;
+    si.count = m->nsensor;
+    
+    std::vector<std::string> names;
+    for (unsigned index = 0; index < si.count; index++)
+    {
+        char *namePointer = m->names + m->name_sensoradr[index];
+        std::string str(namePointer);
+        names.push_back(str);
+    }
+    si.names = names;
+
+    std::vector<unsigned> dim;
+    si.scalarCount = 0;
+    for (unsigned index = 0; index < si.count; index++)
+    {
+        unsigned sensor_dim = m->sensor_dim[index];
+        dim.push_back(sensor_dim);
+        si.scalarCount += sensor_dim;
+    }
+    si.dim = dim;
+
+    std::vector<unsigned> addr;
+    si.isContiguous = true;
+    unsigned expectedAddr = 0;
+    for (unsigned index = 0; index < si.count; index++)
+    {
+        unsigned sensor_addr = m->sensor_adr[index];
+        addr.push_back(sensor_addr);
+
+        if(sensor_addr != expectedAddr) si.isContiguous = false;
+        expectedAddr = sensor_addr + dim[index];
+    }
+    si.addr = addr;
+    return si;
+}
+
+controlInterface MujocoModelInstance::getControlInterface()
+{
+    controlInterface ci;
+    ci.count = m->nu;
+    
+    std::vector<std::string> names;
+    for (unsigned index = 0; index < ci.count; index++)
+    {
+        char *namePointer = m->names + m->name_actuatoradr[index];
+        std::string str(namePointer);
+        names.push_back(str);
+    }
+    ci.names = names;
+    return ci;
+}
+
+cameraInterface MujocoModelInstance::getCameraInterface()
+{
+    // CALL THIS FUNCTION ONLY FROM MAIN THREAD (MAC) OR THE THREAD THAT HANDLES THE REST OF RENDERING GLFW OPENGL WORK
+    // Run init and initCameras before running this
+    cameraInterface camiTemp;
+    camiTemp.count = m->ncam;
+
+    std::vector<std::string> names;
+    for(unsigned index=0; index<camiTemp.count; index++)
+    {
+        char *namePointer = m->names + m->name_camadr[index];
+        std::string str(namePointer);
+        names.push_back(str);
+    }
+    camiTemp.names = names;
+
+    unsigned long rgbAddr = 0;
+    unsigned long depthAddr = 0;
+    for(size_t index=0; index<offscreenCam.size(); index++)
+    {
+        offscreenSize offSize;
+        offscreenCam[index]->initInThread(&offSize, true);
+        // TODO handle error
+        for(unsigned tile=0; tile<offscreenCam[index]->cameraCount(); tile++)
+        {
+            offscreenSize camSize = offscreenCam[index]->outputSize(tile, offSize);
+            camiTemp.size.push_back(camSize);
+            
+            camiTemp.rgbAddr.push_back(rgbAddr);
+            camiTemp.depthAddr.push_back(depthAddr);
+            rgbAddr += 3*camSize.height*camSize.width; // location of next rgb or length of rgb stored so far
+            depthAddr += camSize.height*camSize.width;
+        }
+    }
+    camiTemp.rgbLength = rgbAddr;
+    camiTemp.depthLength = depthAddr;
+    
+    return camiTemp;
+}
+
+void MujocoModelInstance::step(const double *u, unsigned nu)
+{
+    setControl(u, nu);
+    step();
+}
+
+void MujocoModelInstance::step(const double *const *uPtrs, unsigned nu)
+{
+    setControl(uPtrs, nu);
+    step();
+}
+
+void MujocoModelInstance::setControl(const double *u, unsigned nu)
+{
+    if(nu > ci.count) nu = ci.count;
+    memcpy(ctrlTarget.data(), u, nu*sizeof(mjtNum));
+}
+
+void MujocoModelInstance::setControl(const double *const *uPtrs, unsigned nu)
+{
+    if(nu > ci.count) nu = ci.count;
+
+    // Simulink input ports need not be contiguous. Gather element wise
+    for (unsigned index = 0; index < nu; index++)
+    {
+        ctrlTarget[index] = *uPtrs[index];
+    }
+}
+
+void MujocoModelInstance::step()
+{
+    unsigned nu = ci.count;
+    if(!hasPreviousCtrl)
+    {
+        // nothing to interpolate from in the first step
+        memcpy(ctrlPrevious.data(), ctrlTarget.data(), nu*sizeof(mjtNum));
+        hasPreviousCtrl = true;
+    }
+
+    perfCounters::clock::time_point lockStart, stepStart;
+    if(perf.enabled) lockStart = perfCounters::clock::now();
+    std::lock_guard<std::mutex> lock(dMutex);
+    if(perf.enabled) stepStart = perfCounters::clock::now();
+    for(unsigned substep = 0; substep < substeps; substep++)
+    {
+        if(interp == CTRL_FOH)
+        {
+            mjtNum alpha = static_cast<mjtNum>(substep+1)/substeps;
+            for(unsigned index = 0; index < nu; index++)
+            {
+                d->ctrl[index] = ctrlPrevious[index] + alpha*(ctrlTarget[index] - ctrlPrevious[index]);
+            }
+        }
+        else if(substep == 0)
+        {
+            memcpy(d->ctrl, ctrlTarget.data(), nu*sizeof(mjtNum));
+        }
+        mj_step(m, d);
+        if(stateLog) stateLog->record(d->time);
+    }
+    memcpy(ctrlPrevious.data(), ctrlTarget.data(), nu*sizeof(mjtNum));
+    if(perf.enabled)
+    {
+        perf.record(PERF_DMUTEX_WAIT, stepStart - lockStart);
+        perf.record(PERF_STEP, perfCounters::clock::now() - stepStart);
+    }
+
+    // renderer picks this up without taking dMutex
+    publishVisualState();
+}
+
+int MujocoModelInstance::startStateLogging(const std::string &path, const std::string &fieldList)
+{
+    // mjData arrays keep their address for the lifetime of d, so the logger copies straight from them
+    std::vector<stateLogField> fields;
+    size_t start = 0;
+    while(start < fieldList.size())
+    {
+        size_t end = fieldList.find(' ', start);
+        if(end == std::string::npos) end = fieldList.size();
+        std::string name = fieldList.substr(start, end-start);
+        start = end+1;
+        if(name.empty()) continue;
+
+        if(name == "qpos") fields.push_back({name, d->qpos, static_cast<uint32_t>(m->nq)});
+        else if(name == "qvel") fields.push_back({name, d->qvel, static_cast<uint32_t>(m->nv)});
+        else if(name == "qacc") fields.push_back({name, d->qacc, static_cast<uint32_t>(m->nv)});
+        else if(name == "act") fields.push_back({name, d->act, static_cast<uint32_t>(m->na)});
+        else if(name == "ctrl") fields.push_back({name, d->ctrl, static_cast<uint32_t>(m->nu)});
+        else if(name == "qfrc_actuator") fields.push_back({name, d->qfrc_actuator, static_cast<uint32_t>(m->nv)});
+        else if(name == "sensordata") fields.push_back({name, d->sensordata, static_cast<uint32_t>(m->nsensordata)});
+        else if(name == "mocap_pos") fields.push_back({name, d->mocap_pos, static_cast<uint32_t>(3*m->nmocap)});
+        else if(name == "mocap_quat") fields.push_back({name, d->mocap_quat, static_cast<uint32_t>(4*m->nmocap)});
+        else return -1;
+    }
+
+    stateLog = std::make_unique<stateLogger>();
+    if(!stateLog->open(path, fields))
+    {
+        stateLog.reset();
+        return -2;
+    }
+    return 0;
+}
+
+std::vector<double> MujocoModelInstance::getSensor(unsigned index)
+{
+    std::vector<double> sensorData;
+
+    dMutex.lock();
+    auto addrStart = si.addr[index];
+    auto addrEnd = addrStart + si.dim[index] - 1;
+    for (unsigned i = addrStart; i <= addrEnd; i++)
+    {
+        sensorData.push_back(d->sensordata[i]);
+    }
+    dMutex.unlock();
+    return sensorData;
+}
+
+size_t MujocoModelInstance::getSensors(double *buffer)
+{
+    std::lock_guard<std::mutex> lock(dMutex);
+    if(si.isContiguous)
+    {
+        // usual case. sensordata is already laid out in the output order
+        memcpy(buffer, d->sensordata, si.scalarCount*sizeof(mjtNum));
+    }
+    else
+    {
+        // reordered or subset layout. gather each sensor block
+        size_t index = 0;
+        for(unsigned i=0; i<si.count; i++)
+        {
+            memcpy(buffer+index, d->sensordata + si.addr[i], si.dim[i]*sizeof(mjtNum));
+            index += si.dim[i];
+        }
+    }
+    return si.scalarCount;
+}
+
+void forcopy(uint8_t *to, uint8_t *from, size_t size)
+{
+    for(size_t index = 0; index<size; index++)
+    {
+        to[index] = from[index];
+    }
+}
+
+// CAMERA LAYOUT KERNELS
+// Offscreen buffers are in glReadPixels order: rows bottom up, row major, channels interleaved.
+// MATLAB images are H x W x channels, column major, with the top row first.
+// The conversion (flip, transpose and deinterleave) is done in one pass over cache sized blocks,
+//  so that both the reads and the writes stay within a few cache lines.
+// Within a block, SSE2 kernels convert squares of KERNEL rows and columns: rows are loaded (and deinterleaved)
+//  bottom up and transposed in registers, so every store writes KERNEL contiguous values of an output column.
+// Image borders that do not fill a square, other types and other platforms use the scalar loop.
+#define LAYOUT_BLOCK 32
+
+template <typename T, unsigned CHANNELS>
+static void toMatlabLayoutScalar(T *__restrict dst, const T *__restrict src, unsigned H, unsigned W,
+    unsigned row0, unsigned rowEnd, unsigned col0, unsigned colEnd)
+{
+    size_t plane = static_cast<size_t>(H)*W;
+    for(unsigned col=col0; col<colEnd; col++)
+    {
+        T *dstCol = dst + static_cast<size_t>(col)*H + (H-1);
+        for(unsigned row=row0; row<rowEnd; row++)
+        {
+            const T *pixel = src + CHANNELS*(static_cast<size_t>(row)*W + col);
+            for(unsigned ch=0; ch<CHANNELS; ch++)
+            {
+                dstCol[ch*plane - row] = pixel[ch];
+            }
+        }
+    }
+}
+
+template <typename T, unsigned CHANNELS>
+struct layoutKernel
+{
+    static constexpr unsigned KERNEL = 0; // no vector kernel
+    static void convert(T *, const T *, unsigned, unsigned, unsigned, unsigned) {}
+};
+
+#ifdef MJ_LAYOUT_SSE2
+template <unsigned CHANNELS>
+struct layoutKernel<float, CHANNELS>
+{
+    // 4x4 pixels. rows are loaded bottom up, so the transpose also flips them
+    static constexpr unsigned KERNEL = (CHANNELS == 1 || CHANNELS == 3) ? 4 : 0;
+
+    static void convert(float *dst, const float *src, unsigned H, unsigned W, unsigned row, unsigned col)
+    {
+        size_t plane = static_cast<size_t>(H)*W;
+        __m128 rows[CHANNELS][4];
+        for(unsigned index=0; index<4; index++)
+        {
+            loadPixels(src + CHANNELS*(static_cast<size_t>(row+3-index)*W + col), rows, index);
+        }
+        for(unsigned ch=0; ch<CHANNELS; ch++)
+        {
+            _MM_TRANSPOSE4_PS(rows[ch][0], rows[ch][1], rows[ch][2], rows[ch][3]);
+            // rows[ch][k] is column col+k from row+3 down to row, i.e. output rows H-4-row to H-1-row
+            float *dstBlock = dst + ch*plane + static_cast<size_t>(col)*H + (H-4-row);
+            for(unsigned k=0; k<4; k++)
+            {
+                _mm_storeu_ps(dstBlock + static_cast<size_t>(k)*H, rows[ch][k]);
+            }
+        }
+    }
+
+    static void loadPixels(const float *pixel, __m128 (&rows)[CHANNELS][4], unsigned index)
+    {
+        if constexpr(CHANNELS == 1)
+        {
+            rows[0][index] = _mm_loadu_ps(pixel);
+        }
+        else
+        {
+            // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+            __m128 v0 = _mm_loadu_ps(pixel);
+            __m128 v1 = _mm_loadu_ps(pixel+4);
+            __m128 v2 = _mm_loadu_ps(pixel+8);
+            __m128 t0 = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1,0,3,2)); // x2 y2 z2 x3
+            __m128 t1 = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1,0,2,1)); // y0 z0 y1 z1
+            __m128 t2 = _mm_shuffle_ps(t0, v2, _MM_SHUFFLE(3,2,2,1)); // y2 z2 y3 z3
+            rows[0][index] = _mm_shuffle_ps(v0, t0, _MM_SHUFFLE(3,0,3,0));
+            rows[1][index] = _mm_shuffle_ps(t1, t2, _MM_SHUFFLE(2,0,2,0));
+            rows[2][index] = _mm_shuffle_ps(t1, t2, _MM_SHUFFLE(3,1,3,1));
+        }
+    }
+};
+
+template <>
+struct layoutKernel<uint8_t, 3>
+{
+    // 16x16 RGB pixels
+    static constexpr unsigned KERNEL = 16;
+
+    static void convert(uint8_t *dst, const uint8_t *src, unsigned H, unsigned W, unsigned row, unsigned col)
+    {
+        size_t plane = static_cast<size_t>(H)*W;
+        __m128i rows[3][16];
+        for(unsigned index=0; index<16; index++)
+        {
+            const uint8_t *pixel = src + 3*(static_cast<size_t>(row+15-index)*W + col);
+            deinterleave(_mm_loadu_si128((const __m128i *) pixel), _mm_loadu_si128((const __m128i *) (pixel+16)),
+                _mm_loadu_si128((const __m128i *) (pixel+32)), rows[0][index], rows[1][index], rows[2][index]);
+        }
+        for(unsigned ch=0; ch<3; ch++)
+        {
+            transpose(rows[ch]);
+            uint8_t *dstBlock = dst + ch*plane + static_cast<size_t>(col)*H + (H-16-row);
+            for(unsigned k=0; k<16; k++)
+            {
+                _mm_storeu_si128((__m128i *) (dstBlock + static_cast<size_t>(k)*H), rows[ch][k]);
+            }
+        }
+    }
+
+    static void deinterleave(__m128i a, __m128i b, __m128i c, __m128i &r, __m128i &g, __m128i &bl)
+    {
+        // 16 RGB pixels into R, G and B. every round of byte interleaves moves the bytes one step
+        //  closer to their plane, after four rounds they are in place (SSE2 has no byte shuffle)
+        for(int round=0; round<4; round++)
+        {
+            __m128i t0 = _mm_unpacklo_epi8(a, _mm_unpackhi_epi64(b, b));
+            __m128i t1 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(a, a), c);
+            __m128i t2 = _mm_unpacklo_epi8(b, _mm_unpackhi_epi64(c, c));
+            a = t0;
+            b = t1;
+            c = t2;
+        }
+        r = a;
+        g = b;
+        bl = c;
+    }
+
+    static void transpose(__m128i (&rows)[16])
+    {
+        // four rounds of interleaving row i with row i+8 transpose a 16x16 byte matrix
+        for(int round=0; round<4; round++)
+        {
+            __m128i out[16];
+            for(unsigned index=0; index<8; index++)
+            {
+                out[2*index] = _mm_unpacklo_epi8(rows[index], rows[index+8]);
+                out[2*index+1] = _mm_unpackhi_epi8(rows[index], rows[index+8]);
+            }
+            for(unsigned index=0; index<16; index++) rows[index] = out[index];
+        }
+    }
+};
+#endif
+
+template <typename T, unsigned CHANNELS>
+static void toMatlabLayout(T *__restrict dst, const T *__restrict src, unsigned H, unsigned W)
+{
+    constexpr unsigned KERNEL = layoutKernel<T, CHANNELS>::KERNEL;
+    for(unsigned row0=0; row0<H; row0+=LAYOUT_BLOCK)
+    {
+        unsigned rowEnd = std::min(row0+LAYOUT_BLOCK, H);
+        for(unsigned col0=0; col0<W; col0+=LAYOUT_BLOCK)
+        {
+            unsigned colEnd = std::min(col0+LAYOUT_BLOCK, W);
+            unsigned rowVector = row0; // rows and columns converted by the vector kernel
+            unsigned colVector = colEnd;
+            if constexpr(KERNEL > 0)
+            {
+                // LAYOUT_BLOCK is a multiple of KERNEL, so only the image borders are left over
+                rowVector = row0 + (rowEnd-row0)/KERNEL*KERNEL;
+                colVector = col0 + (colEnd-col0)/KERNEL*KERNEL;
+                for(unsigned col=col0; col<colVector; col+=KERNEL)
+                {
+                    for(unsigned row=row0; row<rowVector; row+=KERNEL)
+                    {
+                        layoutKernel<T, CHANNELS>::convert(dst, src, H, W, row, col);
+                    }
+                }
+            }
+            toMatlabLayoutScalar<T, CHANNELS>(dst, src, H, W, rowVector, rowEnd, col0, colEnd);
+            toMatlabLayoutScalar<T, CHANNELS>(dst, src, H, W, row0, rowVector, colVector, colEnd);
+        }
+    }
+}
+
+template <typename T, unsigned CHANNELS>
+static size_t copyCameraBuffers(T *buffer, std::vector<std::shared_ptr<MujocoGUI>> &offscreenCam, cameraInterface &cami,
+    T *MujocoGUI::*field, bool matlabLayout)
+{
+    // an offscreen object holds one camera or, in atlas mode, all of them back to back
+    // if cami.count is 0, either no camera is in model or camera is not initialized
+    size_t addr = 0;
+    unsigned camIndex = 0;
+    for(size_t index=0; index<offscreenCam.size() && camIndex<cami.count; index++ )
+    {
+        MujocoGUI &gui = *offscreenCam[index];
+        std::lock_guard<std::mutex> mutLock(gui.camBufferMutex);
+        const T *src = gui.*field;
+        if(!src) return addr;
+
+        size_t offset = 0;
+        for(unsigned tile=0; tile<gui.cameraCount() && camIndex<cami.count; tile++, camIndex++)
+        {
+            unsigned H = cami.size[camIndex].height;
+            unsigned W = cami.size[camIndex].width;
+            size_t size = CHANNELS*static_cast<size_t>(H)*W;
+            if(matlabLayout)
+            {
+                toMatlabLayout<T, CHANNELS>(buffer+addr, src+offset, H, W);
+            }
+            else
+            {
+                memcpy(buffer+addr, src+offset, size*sizeof(T));
+            }
+            offset += size;
+            addr += size;
+        }
+    }
+    return addr;
+}
+
+size_t MujocoModelInstance::getCameraRGB(uint8_t *buffer)
+{
+    std::lock_guard<std::mutex> mutLock(camiMutex);
+    return copyCameraBuffers<uint8_t, 3>(buffer, offscreenCam, cami, &MujocoGUI::rgb, cameraMatlabLayout);
+}
+
+void MujocoModelInstance::getCameraDepth(float *buffer)
+{
+    std::lock_guard<std::mutex> mutLock(camiMutex);
+    copyCameraBuffers<float, 1>(buffer, offscreenCam, cami, &MujocoGUI::depth, cameraMatlabLayout);
+}
+
+void MujocoModelInstance::getCameraPointCloud(float *buffer)
+{
+    std::lock_guard<std::mutex> mutLock(camiMutex);
+    copyCameraBuffers<float, 3>(buffer, offscreenCam, cami, &MujocoGUI::points, cameraMatlabLayout);
+}
+
+bool MujocoModelInstance::startFrameRecording()
+{
+    std::lock_guard<std::mutex> mutLock(camiMutex);
+    std::vector<std::string> names;
+    std::vector<uint32_t> heights;
+    std::vector<uint32_t> widths;
+    for(unsigned index=0; index<cami.count; index++)
+    {
+        names.push_back(std::string(m->names + m->name_camadr[index]));
+        heights.push_back(cami.size[index].height);
+        widths.push_back(cami.size[index].width);
+    }
+
+    frameLog = std::make_unique<frameRecorder>();
+    if(!frameLog->open(frameRecordPath, names, heights, widths, cameraMatlabLayout))
+    {
+        frameLog.reset();
+        return false;
+    }
+    return true;
+}
+
+void MujocoModelInstance::recordFrame(double time)
+{
+    if(!frameLog) return;
+    frameRecorder::frame *item = frameLog->acquireFrame();
+    getCameraRGB(item->rgb.data());
+    getCameraDepth(item->depth.data());
+    frameLog->commitFrame(item, time);
+}
+
+// BLOCK SEQUENCE -----------------------------------------------------------------
+// Per sample steps of a block (mdlOutputs/mdlUpdate), shared by the S-Function and mj_bench
+static void deferredStepTask(void *arg)
+{
+    auto mi = static_cast<MujocoModelInstance *>(arg);
+    {
+        traceRecorder::global().setThreadName("step worker");
+        traceScope trace("step");
+        mi->step();
+    }
+    mi->stepDone.release();
+}
+
+void MujocoModelInstance::stepInPool(workStealingPool &pool, const double *u, unsigned nu)
+{
+    // inputs are only valid during this call. copy them now and let the pool advance the physics
+    setControl(u, nu);
+    isStepPending = true;
+    pool.submit({deferredStepTask, this});
+}
+
+void MujocoModelInstance::stepInPool(workStealingPool &pool, const double *const *uPtrs, unsigned nu)
+{
+    setControl(uPtrs, nu);
+    isStepPending = true;
+    pool.submit({deferredStepTask, this});
+}
+
+bool MujocoModelInstance::joinPendingStep(int traceIndex)
+{
+    if(!isStepPending) return false;
+    traceScope joinTrace("step join", traceIndex);
+    stepDone.acquire();
+    isStepPending = false;
+    return true;
+}
+
+void MujocoModelInstance::quiesce()
+{
+    // no deferred step or pipelined render may touch the state while it is saved/restored/reset
+    joinPendingStep(-1);
+    if(isCameraRequestInFlight)
+    {
+        cameraSync.acquire();
+        isCameraRequestInFlight = false;
+    }
+}
+
+cameraSampleStatus MujocoModelInstance::requestCameraSample(eventSignal &renderWakeup, int traceIndex)
+{
+    // mdlupdate will be called after mdloutputs and update moves the time tk to tk+1
+    if(offscreenCam.size() == 0) return CAMERA_NOT_DUE;
+    double elapsedTimeSinceRender = d->time - lastRenderTime;
+    if(elapsedTimeSinceRender <= (cameraRenderInterval-0.00001)) return CAMERA_NOT_DUE;
+
+    traceRecorder &tracer = traceRecorder::global();
+    if(cameraPipelined)
+    {
+        // output the frame requested at the previous camera sample. it has been rendering during the physics steps since.
+        cameraSampleStatus status = CAMERA_REQUESTED;
+        if(isCameraRequestInFlight)
+        {
+            traceScope waitTrace("camera wait", traceIndex);
+            auto waitStart = perf.now();
+            cameraSync.acquire();
+            perf.recordSince(PERF_CAMERA_WAIT, waitStart);
+            isCameraRequestInFlight = false;
+            status = CAMERA_COLLECTED;
+        }
+
+        // request the frame for the current state and carry on without waiting
+        captureCameraState();
+        lastRenderTime = d->time;
+        isCameraRequestInFlight = true;
+        shouldCameraRenderNow = true;
+        tracer.instant("camera request", traceIndex);
+        renderWakeup.notify();
+        return status;
+    }
+
+    // maintain camera and physics in sync at required camera sample time
+    lastRenderTime = d->time;
+    traceScope waitTrace("camera wait", traceIndex);
+    auto waitStart = perf.now();
+    shouldCameraRenderNow = true;
+    tracer.instant("camera request", traceIndex);
+    renderWakeup.notify();
+    cameraSync.acquire(); // blocking till offscreen buffer is rendered
+    perf.recordSince(PERF_CAMERA_WAIT, waitStart);
+    return CAMERA_COLLECTED;
+}
+
+bool MujocoModelInstance::copyCameraFrame(uint8_t *rgb, float *depth, float *points, int traceIndex)
+{
+    //avoid unnecessary memcpy. copy only when there is new data. Rest of the time steps, old data will be output
+    if(!isCameraDataNew) return false;
+    traceScope copyTrace("camera copy", traceIndex);
+    auto copyStart = perf.now();
+    getCameraRGB(rgb);
+    getCameraDepth(depth);
+    if(points) getCameraPointCloud(points);
+    perf.recordSince(PERF_CAMERA_COPY, copyStart);
+    isCameraDataNew = false;
+    return true;
+}
+
+// RENDERING THREAD ---------------------------------------------------------------
+guiErrCodes MujocoModelInstance::initRenderingInThread()
+{
+    guiErrCodes status = NO_ERR;
+    {
+        std::lock_guard<std::mutex> mutLock(camiMutex);
+        cami.count = m->ncam;
+        // names are not needed by the rendering thread
+
+        unsigned long rgbAddr = 0;
+        unsigned long depthAddr = 0;
+        for(auto &cam: offscreenCam)
+        {
+            offscreenSize offSize;
+            guiErrCodes guiStatus = cam->initInThread(&offSize);
+            if(guiStatus != NO_ERR) status = guiStatus;
+
+            // in atlas mode one offscreen object holds all the cameras
+            // sizes are reduced by the camera's region of interest and downsampling (if any)
+            for(unsigned tile=0; tile<cam->cameraCount(); tile++)
+            {
+                offscreenSize camSize = cam->outputSize(tile, offSize);
+                cami.size.push_back(camSize);
+                cami.rgbAddr.push_back(rgbAddr);
+                cami.depthAddr.push_back(depthAddr);
+                rgbAddr += 3*camSize.height*camSize.width; // location of next rgb or length of rgb stored so far
+                depthAddr += camSize.height*camSize.width;
+            }
+        }
+        cami.rgbLength = rgbAddr;
+        cami.depthLength = depthAddr;
+    }
+
+    if(!frameRecordPath.empty() && cami.count > 0 && !startFrameRecording())
+    {
+        status = FRAME_RECORDER_OPEN_FAILED;
+    }
+    return status;
+}
+
+void MujocoModelInstance::serveCameraRequestInThread(int traceIndex)
+{
+    if(shouldCameraRenderNow == false) return;
+    traceRecorder &tracer = traceRecorder::global();
+
+    if(shouldRenderCameras())
+    {
+        auto renderStart = perf.now();
+        tracer.begin("camera render", traceIndex);
+        bool isFrameNew = false;
+        for(auto &cam: offscreenCam)
+        {
+            if(cam->loopInThread() == 0 && !cam->asyncReadback) isFrameNew = true;
+        }
+
+        // asynchronous readbacks output the frame of the previous request. it has been transferring since then
+        // lastRenderTime is written before the request is signalled
+        double frameTime = lastRenderTime;
+        if(cameraAsyncReadback)
+        {
+            frameTime = readbackFrameTime;
+            readbackFrameTime = lastRenderTime;
+        }
+        for(auto &cam: offscreenCam)
+        {
+            if(cam->completeReadbackInThread() == 0) isFrameNew = true;
+        }
+        if(isFrameNew)
+        {
+            isCameraDataNew = true; // new data for the block outputs
+            recordFrame(frameTime);
+        }
+        perf.recordSince(PERF_RENDER, renderStart);
+        tracer.end("camera render", traceIndex);
+    }
+    else
+    {
+        // nothing visible moved. the block outputs still hold the last frame.
+        // a pending asynchronous readback is the latest frame. it is mapped now rather than at the next render
+        // the recording keeps one frame per camera sample
+        tracer.instant("camera skip", traceIndex);
+        for(auto &cam: offscreenCam)
+        {
+            if(cam->flushReadbackInThread() == 0) isCameraDataNew = true;
+        }
+        recordFrame(lastRenderTime);
+    }
+    shouldCameraRenderNow = false;
+    tracer.instant("camera ready", traceIndex);
+    cameraSync.release();
+}
+
+void MujocoModelInstance::releaseRenderingInThread()
+{
+    for(auto &cam: offscreenCam)
+    {
+        cam->releaseInThread();
+    }
+}
+
+std::chrono::steady_clock::time_point renderWindowsInThread(std::vector<std::shared_ptr<MujocoGUI>> &windows)
+{
+    auto nextWindowDeadline = std::chrono::steady_clock::time_point::max();
+    for(size_t index=0; index<windows.size(); index++)
+    {
+        MujocoGUI &gui = *windows[index];
+        if(gui.exited) continue; // closed by user or failed init
+
+        auto duration = std::chrono::steady_clock::now() - gui.lastRenderClockTime;
+        if(duration > gui.renderInterval)
+        {
+            traceScope trace("window frame", static_cast<int>(index));
+            if(gui.loopInThread() == 0)
+            {
+                gui.lastRenderClockTime = std::chrono::steady_clock::now();
+            }
+        }
+
+        if(!gui.exited)
+        {
+            auto deadline = gui.lastRenderClockTime + gui.renderInterval;
+            if(deadline < nextWindowDeadline) nextWindowDeadline = deadline;
+        }
+    }
+    return nextWindowDeadline;
+}
+
+// GL CONTEXT BACKENDS ------------------------------------------------------------
+static int err;
+static char des[1000];
+void glfwFailCallback(int error, const char* description)
+{
+    err = error;
+    strncpy(des, description, sizeof(des));
+}
+
+class glfwContext : public glContext
+{
+    GLFWwindow *window = NULL;
+
+    public:
+    guiErrCodes create(glTarget target) override
+    {
+        glfwSetErrorCallback(&glfwFailCallback);
+        if(glfwInit() == 0) return GLFW_INIT_FAILED;
+
+        bool isWindow = (target == MJ_WINDOW);
+        glfwWindowHint(GLFW_VISIBLE, isWindow ? GLFW_TRUE : GLFW_FALSE);
+        glfwWindowHint(GLFW_DOUBLEBUFFER, isWindow ? GLFW_TRUE : GLFW_FALSE);
+
+        window = glfwCreateWindow(800, 800, "Simulation", NULL, NULL);
+        if(!window) return WINDOW_CREATION_FAILED;
+        return NO_ERR;
+    }
+    void makeCurrent() override { glfwMakeContextCurrent(window); }
+    void releaseCurrent() override { glfwMakeContextCurrent(NULL); }
+    void destroy() override
+    {
+        if(window) glfwDestroyWindow(window);
+        window = NULL;
+    }
+    void *getProcAddress(const char *name) override { return (void *) glfwGetProcAddress(name); }
+    GLFWwindow *getWindow() override { return window; }
+};
+
+#ifdef MJ_EGL
+static EGLDisplay eglDeviceDisplay()
+{
+    // EGL_EXT_platform_device opens a GPU directly, without a display server. EGL_DEFAULT_DISPLAY often fails
+    //  or picks the wrong GPU on headless nodes. Uses device MUJOCO_EGL_DEVICE_ID (if set) or the first device
+    //  that initializes. Falls back to the default display when the extension is missing
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto queryDevices = (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+    auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if(!clientExtensions || !strstr(clientExtensions, "EGL_EXT_platform_device") || !queryDevices || !getPlatformDisplay)
+    {
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    const EGLint maxDevices = 32;
+    EGLDeviceEXT devices[maxDevices];
+    EGLint deviceCount = 0;
+    if(queryDevices(maxDevices, devices, &deviceCount) != EGL_TRUE || deviceCount < 1)
+    {
+        return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    const char *deviceIdStr = getenv("MUJOCO_EGL_DEVICE_ID");
+    if(deviceIdStr && deviceIdStr[0] != '\0')
+    {
+        int deviceId = atoi(deviceIdStr);
+        if(deviceId < 0 || deviceId >= deviceCount) return EGL_NO_DISPLAY;
+        return getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[deviceId], NULL);
+    }
+
+    for(EGLint index=0; index<deviceCount; index++)
+    {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[index], NULL);
+        EGLint major, minor;
+        if(display != EGL_NO_DISPLAY && eglInitialize(display, &major, &minor) == EGL_TRUE) return display;
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+// Headless rendering on a GPU (or Mesa) without a display server. Build with -DMJ_EGL and link libEGL
+class eglContext : public glContext
+{
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext eglCtx = EGL_NO_CONTEXT;
+
+    public:
+    guiErrCodes create(glTarget target) override
+    {
+        if(target != MJ_OFFSCREEN) return UNKNOWN_TARGET;
+
+        // enumerated once. every context of the process shares the display
+        static EGLDisplay deviceDisplay = eglDeviceDisplay();
+        display = deviceDisplay;
+        if(display == EGL_NO_DISPLAY) return GL_CONTEXT_CREATION_FAILED;
+
+        EGLint major, minor;
+        if(eglInitialize(display, &major, &minor) != EGL_TRUE) return GL_CONTEXT_CREATION_FAILED;
+
+        const EGLint configAttributes[] = {
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            EGL_DEPTH_SIZE, 24,
+            EGL_STENCIL_SIZE, 8,
+            EGL_COLOR_BUFFER_TYPE, EGL_RGB_BUFFER,
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if(eglChooseConfig(display, configAttributes, &config, 1, &configCount) != EGL_TRUE || configCount < 1)
+        {
+            return GL_CONTEXT_CREATION_FAILED;
+        }
+
+        if(eglBindAPI(EGL_OPENGL_API) != EGL_TRUE) return GL_CONTEXT_CREATION_FAILED;
+
+        eglCtx = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+        if(eglCtx == EGL_NO_CONTEXT) return GL_CONTEXT_CREATION_FAILED;
+        return NO_ERR;
+    }
+    // surfaceless. MuJoCo renders into its own offscreen framebuffer
+    void makeCurrent() override { eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, eglCtx); }
+    void releaseCurrent() override { eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT); }
+    void destroy() override
+    {
+        // the display is shared by every context in the process. it is not terminated here
+        if(eglCtx != EGL_NO_CONTEXT)
+        {
+            releaseCurrent();
+            eglDestroyContext(display, eglCtx);
+        }
+        eglCtx = EGL_NO_CONTEXT;
+    }
+    void *getProcAddress(const char *name) override { return (void *) eglGetProcAddress(name); }
+};
+#endif
+
+#ifdef MJ_OSMESA
+// Software rendering without a display server or GPU. Build with -DMJ_OSMESA and link libOSMesa
+class osmesaContext : public glContext
+{
+    OSMesaContext mesaCtx = NULL;
+    std::vector<unsigned char> defaultFramebuffer; // required by OSMesa. MuJoCo renders into its own framebuffer
+    static const int FB_SIZE = 800;
+
+    public:
+    guiErrCodes create(glTarget target) override
+    {
+        if(target != MJ_OFFSCREEN) return UNKNOWN_TARGET;
+
+        mesaCtx = OSMesaCreateContextExt(OSMESA_RGBA, 24, 8, 8, NULL);
+        if(!mesaCtx) return GL_CONTEXT_CREATION_FAILED;
+        defaultFramebuffer.resize(4*FB_SIZE*FB_SIZE);
+        return NO_ERR;
+    }
+    void makeCurrent() override { OSMesaMakeCurrent(mesaCtx, defaultFramebuffer.data(), GL_UNSIGNED_BYTE, FB_SIZE, FB_SIZE); }
+    void releaseCurrent() override { OSMesaMakeCurrent(NULL, NULL, GL_UNSIGNED_BYTE, 0, 0); }
+    void destroy() override
+    {
+        if(mesaCtx) OSMesaDestroyContext(mesaCtx);
+        mesaCtx = NULL;
+    }
+    void *getProcAddress(const char *name) override { return (void *) OSMesaGetProcAddress(name); }
+};
+#endif
+
+std::unique_ptr<glContext> makeGlContext(glBackendType backend)
+{
+    switch(backend)
+    {
+        case MJ_GL_GLFW:
+            return std::make_unique<glfwContext>();
+#ifdef MJ_EGL
+        case MJ_GL_EGL:
+            return std::make_unique<eglContext>();
+#endif
+#ifdef MJ_OSMESA
+        case MJ_GL_OSMESA:
+            return std::make_unique<osmesaContext>();
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+bool parseGlBackend(const std::string &name, glBackendType &backend)
 {
-    return d;
+    if(name == "glfw") backend = MJ_GL_GLFW;
+    else if(name == "egl") backend = MJ_GL_EGL;
+    else if(name == "osmesa") backend = MJ_GL_OSMESA;
+    else return false;
+    return true;
 }
 
-double MujocoModelInstance::getSampleTime()
+glBackendType defaultGlBackend()
 {
-    return m->opt.timestep;
+    // same variable as MuJoCo's python bindings
+    glBackendType backend = MJ_GL_GLFW;
+    const char *env = getenv("MUJOCO_GL");
+    if(env) parseGlBackend(env, backend);
+    return backend;
 }
 
-sensorInterface MujocoModelInstance::getSensorInterface()
+// ASYNCHRONOUS READBACK ----------------------------------------------------------
+// GL 2.1/3.0 entry points that are not exported by every platform's GL library. Loaded through the context backend.
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#define MJ_GL_PIXEL_PACK_BUFFER 0x88EB
+#define MJ_GL_STREAM_READ 0x88E1
+#define MJ_GL_READ_ONLY 0x88B8
+#define MJ_GL_READ_FRAMEBUFFER 0x8CA8
+#define MJ_GL_DRAW_FRAMEBUFFER 0x8CA9
+#define MJ_GL_COLOR_ATTACHMENT0 0x8CE0
+
+typedef void (APIENTRY *glGenBuffersFcn)(GLsizei n, GLuint *buffers);
+typedef void (APIENTRY *glDeleteBuffersFcn)(GLsizei n, const GLuint *buffers);
+typedef void (APIENTRY *glBindBufferFcn)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *glBufferDataFcn)(GLenum target, ptrdiff_t size, const void *data, GLenum usage);
+typedef void *(APIENTRY *glMapBufferFcn)(GLenum target, GLenum access);
+typedef GLboolean (APIENTRY *glUnmapBufferFcn)(GLenum target);
+typedef void (APIENTRY *glBindFramebufferFcn)(GLenum target, GLuint framebuffer);
+typedef void (APIENTRY *glBlitFramebufferFcn)(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1,
+    GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+
+struct pixelBufferReadback
 {
-    sensorInterface si;
-    si.count = m->nsensor;
-    
-    std::vector<std::string> names;
-    for (unsigned index = 0; index < si.count; index++)
+    glGenBuffersFcn genBuffers;
+    glDeleteBuffersFcn deleteBuffers;
+    glBindBufferFcn bindBuffer;
+    glBufferDataFcn bufferData;
+    glMapBufferFcn mapBuffer;
+    glUnmapBufferFcn unmapBuffer;
+    glBindFramebufferFcn bindFramebuffer;
+    glBlitFramebufferFcn blitFramebuffer;
+
+    // Ping-pong buffers. The frame of a request is read into buffers[writeIndex] and mapped at the next request,
+    //  while the frame of that request is read into the other buffer
+    GLuint buffers[2] = {0, 0};
+    unsigned writeIndex = 0;
+    bool isPending[2] = {false, false}; // a read was issued and not mapped yet
+    bool isDepthFlipped[2] = {false, false}; // raw depth has to be flipped to the readDepthMap convention
+    size_t depthOffset = 0; // rgb at offset 0, depth after it (16 byte aligned)
+    size_t bufferSize = 0;
+};
+
+bool MujocoGUI::initAsyncReadback()
+{
+    // context must be current
+    pbo = std::make_unique<pixelBufferReadback>();
+    pbo->genBuffers = (glGenBuffersFcn) context->getProcAddress("glGenBuffers");
+    pbo->deleteBuffers = (glDeleteBuffersFcn) context->getProcAddress("glDeleteBuffers");
+    pbo->bindBuffer = (glBindBufferFcn) context->getProcAddress("glBindBuffer");
+    pbo->bufferData = (glBufferDataFcn) context->getProcAddress("glBufferData");
+    pbo->mapBuffer = (glMapBufferFcn) context->getProcAddress("glMapBuffer");
+    pbo->unmapBuffer = (glUnmapBufferFcn) context->getProcAddress("glUnmapBuffer");
+    pbo->bindFramebuffer = (glBindFramebufferFcn) context->getProcAddress("glBindFramebuffer");
+    pbo->blitFramebuffer = (glBlitFramebufferFcn) context->getProcAddress("glBlitFramebuffer");
+    if(!pbo->genBuffers || !pbo->deleteBuffers || !pbo->bindBuffer || !pbo->bufferData || !pbo->mapBuffer ||
+        !pbo->unmapBuffer || !pbo->bindFramebuffer || !pbo->blitFramebuffer)
     {
-        char *namePointer = m->names + m->name_sensoradr[index];
-        std::string str(namePointer);
-        names.push_back(str);
+        pbo.reset();
+        return false;
     }
-    si.names = names;
 
-    std::vector<unsigned> dim;
-    si.scalarCount = 0;
-    for (unsigned index = 0; index < si.count; index++)
-    {
-        unsigned sensor_dim = m->sensor_dim[index];
-        dim.push_back(sensor_dim);
-        si.scalarCount += sensor_dim;
-    }
-    si.dim = dim;
+    size_t pixelCount = static_cast<size_t>(viewport.width)*viewport.height;
+    pbo->depthOffset = (3*pixelCount + 15) & ~static_cast<size_t>(15);
+    pbo->bufferSize = pbo->depthOffset + sizeof(float)*pixelCount;
 
-    std::vector<unsigned> addr;
-    for (unsigned index = 0; index < si.count; index++)
+    pbo->genBuffers(2, pbo->buffers);
+    for(int index=0; index<2; index++)
     {
-        unsigned sensor_addr = m->sensor_adr[index];
-        addr.push_back(sensor_addr);
+        pbo->bindBuffer(MJ_GL_PIXEL_PACK_BUFFER, pbo->buffers[index]);
+        pbo->bufferData(MJ_GL_PIXEL_PACK_BUFFER, pbo->bufferSize, NULL, MJ_GL_STREAM_READ);
     }
-    si.addr = addr;
-    return si;
+    pbo->bindBuffer(MJ_GL_PIXEL_PACK_BUFFER, 0);
+    return true;
 }
 
-controlInterface MujocoModelInstance::getControlInterface()
+void MujocoGUI::issueAsyncReadback()
 {
-    controlInterface ci;
-    ci.count = m->nu;
-    
-    std::vector<std::string> names;
-    for (unsigned index = 0; index < ci.count; index++)
+    // same resolve as mjr_readPixels, but glReadPixels writes into a pixel buffer object and returns immediately
+    if(discardPendingReadback.exchange(false))
     {
-        char *namePointer = m->names + m->name_actuatoradr[index];
-        std::string str(namePointer);
-        names.push_back(str);
+        // frames of the previous run (fast restart)
+        pbo->isPending[0] = false;
+        pbo->isPending[1] = false;
     }
-    ci.names = names;
-    return ci;
-}
-
-cameraInterface MujocoModelInstance::getCameraInterface()
-{
-    // CALL THIS FUNCTION ONLY FROM MAIN THREAD (MAC) OR THE THREAD THAT HANDLES THE REST OF RENDERING GLFW OPENGL WORK
-    // Run init and initCameras before running this
-    cameraInterface camiTemp;
-    camiTemp.count = offscreenCam.size();
 
-    std::vector<std::string> names;
-    for(unsigned index=0; index<camiTemp.count; index++)
+    // the raw depth buffer is reversed (near at 1) when MuJoCo renders with reversed z, i.e. the depth test is GL_GREATER.
+    // mjr_readPixels returns it in the readDepthMap convention, and so does the mapped frame
+    GLint depthFunc = GL_LESS;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    bool isRawReversed = (depthFunc == GL_GREATER || depthFunc == GL_GEQUAL);
+    bool isReversedWanted = (con.readDepthMap == mjDEPTH_ZEROFAR);
+    pbo->isDepthFlipped[pbo->writeIndex] = (isRawReversed != isReversedWanted);
+
+    int W = viewport.width;
+    int H = viewport.height;
+    if(con.offSamples)
     {
-        char *namePointer = m->names + m->name_camadr[index];
-        std::string str(namePointer);
-        names.push_back(str);
+        pbo->bindFramebuffer(MJ_GL_READ_FRAMEBUFFER, con.offFBO);
+        glReadBuffer(MJ_GL_COLOR_ATTACHMENT0);
+        pbo->bindFramebuffer(MJ_GL_DRAW_FRAMEBUFFER, con.offFBO_r);
+        glDrawBuffer(MJ_GL_COLOR_ATTACHMENT0);
+        pbo->blitFramebuffer(0, 0, W, H, 0, 0, W, H, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        pbo->bindFramebuffer(MJ_GL_READ_FRAMEBUFFER, con.offFBO_r);
     }
-    camiTemp.names = names;
-
-    unsigned long rgbAddr = 0;
-    unsigned long depthAddr = 0;
-    for(int index=0; index<camiTemp.count; index++)
+    else
     {
-        offscreenSize offSize;
-        offscreenCam[index]->initInThread(&offSize, true);
-        // TODO handle error
-        camiTemp.size.push_back(offSize);
-        
-        camiTemp.rgbAddr.push_back(rgbAddr);
-        camiTemp.depthAddr.push_back(depthAddr);
-        rgbAddr += 3*offSize.height*offSize.width; // location of next rgb or length of rgb stored so far
-        depthAddr += offSize.height*offSize.width;
+        pbo->bindFramebuffer(MJ_GL_READ_FRAMEBUFFER, con.offFBO);
     }
-    camiTemp.rgbLength = rgbAddr;
-    camiTemp.depthLength = depthAddr;
-    
-    return camiTemp;
+    glReadBuffer(MJ_GL_COLOR_ATTACHMENT0);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    pbo->bindBuffer(MJ_GL_PIXEL_PACK_BUFFER, pbo->buffers[pbo->writeIndex]);
+    glReadPixels(0, 0, W, H, GL_RGB, GL_UNSIGNED_BYTE, (void *) 0);
+    glReadPixels(0, 0, W, H, GL_DEPTH_COMPONENT, GL_FLOAT, (void *) pbo->depthOffset);
+    pbo->bindBuffer(MJ_GL_PIXEL_PACK_BUFFER, 0);
+
+    mjr_setBuffer(mjFB_OFFSCREEN, &con); // restore MuJoCo's framebuffer binding
+    pbo->isPending[pbo->writeIndex] = true;
+    pbo->writeIndex ^= 1; // now the buffer of the previous request
 }
 
-void MujocoModelInstance::step(std::vector<double> u)
+int MujocoGUI::completeReadbackInThread()
 {
-    // same memory location will be accessed during gui rendering
-    dMutex.lock();
-    for (unsigned index = 0; index < u.size(); index++)
-    {
-        d->ctrl[index] = u[index];
-    }
-    mj_step(m, d);
-    dMutex.unlock();
+    // frame of the previous request. it has been transferring since then (e.g. during the physics steps)
+    if(exited || !pbo) return -1;
+    return mapReadback(pbo->writeIndex);
 }
 
-std::vector<double> MujocoModelInstance::getSensor(unsigned index)
+int MujocoGUI::flushReadbackInThread()
 {
-    std::vector<double> sensorData;
-
-    dMutex.lock();
-    auto addrStart = si.addr[index];
-    auto addrEnd = addrStart + si.dim[index] - 1;
-    for (unsigned i = addrStart; i <= addrEnd; i++)
-    {
-        sensorData.push_back(d->sensordata[i]);
-    }
-    dMutex.unlock();
-    return sensorData;
+    // every pending frame, oldest first. the last one is the frame of the latest render
+    if(exited || !pbo) return -1;
+    int older = mapReadback(pbo->writeIndex);
+    int newer = mapReadback(pbo->writeIndex^1);
+    return (older == 0 || newer == 0) ? 0 : -1;
 }
 
-void forcopy(uint8_t *to, uint8_t *from, size_t size)
+int MujocoGUI::mapReadback(unsigned index)
 {
-    for(size_t index = 0; index<size; index++)
+    if(!pbo->isPending[index]) return -1;
+
+    std::lock_guard<std::recursive_mutex> glLock (glfwMutex);
+    context->makeCurrent();
+
+    size_t pixelCount = static_cast<size_t>(viewport.width)*viewport.height;
+    pbo->bindBuffer(MJ_GL_PIXEL_PACK_BUFFER, pbo->buffers[index]);
+    unsigned char *mapped = (unsigned char *) pbo->mapBuffer(MJ_GL_PIXEL_PACK_BUFFER, MJ_GL_READ_ONLY);
+    if(mapped)
     {
-        to[index] = from[index];
+        memcpy(rgbFrame(), mapped, 3*pixelCount);
+        memcpy(depthFrame(), mapped + pbo->depthOffset, sizeof(float)*pixelCount);
+        pbo->unmapBuffer(MJ_GL_PIXEL_PACK_BUFFER);
     }
-}
+    pbo->bindBuffer(MJ_GL_PIXEL_PACK_BUFFER, 0);
+    context->releaseCurrent();
 
-size_t MujocoModelInstance::getCameraRGB(uint8_t *buffer)
-{
-    std::lock_guard<std::mutex> mutLock(camiMutex);
-    // if cami.count is 0, either no camera is in model or camera is not initialized
-    size_t addr = 0;
-    for(int index=0; index<cami.count; index++ )
+    pbo->isPending[index] = false;
+    if(!mapped) return -1;
+
+    if(pbo->isDepthFlipped[index])
     {
-        size_t rgbArraySize = 3*cami.size[index].height*cami.size[index].width;
+        float *frameDepth = depthFrame();
+        for(size_t index=0; index<pixelCount; index++)
         {
-            std::lock_guard<std::mutex> mutLock(offscreenCam[index]->camBufferMutex);
-            memcpy(buffer+addr, offscreenCam[index]->rgb, rgbArraySize*sizeof(uint8_t));
-            // forcopy(buffer+addr, offscreenCam[index]->rgb, rgbArraySize);
+            frameDepth[index] = 1.0f - frameDepth[index];
         }
-        addr += rgbArraySize;
     }
-    return addr;
+
+    publishBackBuffers();
+    return 0;
 }
 
-void MujocoModelInstance::getCameraDepth(float *buffer)
+void MujocoGUI::releaseAsyncReadback()
 {
-    std::lock_guard<std::mutex> mutLock(camiMutex);
-    unsigned long addr = 0;
-    for(int index=0; index<cami.count; index++ )
+    // context must be current
+    if(pbo)
     {
-        unsigned long size = cami.size[index].height*cami.size[index].width;
-        {
-            std::lock_guard<std::mutex> mutLock(offscreenCam[index]->camBufferMutex);
-            memcpy(buffer+addr, offscreenCam[index]->depth, size*sizeof(float));
-        }
-        addr += size;
+        pbo->deleteBuffers(2, pbo->buffers);
+        pbo.reset();
     }
 }
 
@@ -261,14 +1783,6 @@ guiErrCodes MujocoGUI::init(std::shared_ptr<MujocoModelInstance> mdlInstance, gl
     return init(mdlInstance.get(), openglTarget);
 }
 
-static int err;
-static char des[1000];
-void glfwFailCallback(int error, const char* description)
-{
-    err = error;
-    strncpy(des, description, sizeof(des));
-}
-
 guiErrCodes MujocoGUI::init(MujocoModelInstance* mdlInstance, glTarget openglTarget)
 {
     // sets some variables and initializes opengl. Window creation is done in thread init.
@@ -289,38 +1803,30 @@ guiErrCodes MujocoGUI::initInThread(offscreenSize *offSize, bool stopAtOffScreen
 {
     std::lock_guard<std::recursive_mutex> glLock (glfwMutex); //opengl is not threadsafe or reentrant. lock until it is safe to unlock
     
-    glfwSetErrorCallback(&glfwFailCallback);
-    if(glfwInit() == 0) 
+    if(target != MJ_WINDOW && target != MJ_OFFSCREEN)
     {
         exited = true;
-        // stop any further opengl work for this object
-        return GLFW_INIT_FAILED;
+        return UNKNOWN_TARGET;
     }
 
-    if(target == MJ_WINDOW)
-    {
-        glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
-        glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_TRUE); 
-    }
-    else if(target == MJ_OFFSCREEN)
-    {
-        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-        glfwWindowHint(GLFW_DOUBLEBUFFER, GLFW_FALSE);
-    }
-    else
+    // windows need GLFW. offscreen targets use the selected backend
+    context = makeGlContext(target == MJ_WINDOW ? MJ_GL_GLFW : backend);
+    if(!context)
     {
         exited = true;
-        return UNKNOWN_TARGET;
+        return GL_BACKEND_NOT_AVAILABLE;
     }
 
-    window = glfwCreateWindow(800, 800, "Simulation", NULL, NULL);
-    if( !window ) 
+    guiErrCodes contextStatus = context->create(target);
+    if(contextStatus != NO_ERR)
     {
+        // stop any further opengl work for this object
         exited = true;
-        return WINDOW_CREATION_FAILED;
+        return contextStatus;
     }
+    window = context->getWindow();
 
-    glfwMakeContextCurrent(window);
+    context->makeCurrent();
 
     if(target == MJ_WINDOW) glfwSwapInterval(static_cast<int>(isVsyncOn)); // turn vsync for on screen rendering
 
@@ -347,7 +1853,7 @@ guiErrCodes MujocoGUI::initInThread(offscreenSize *offSize, bool stopAtOffScreen
     mjr_defaultContext(&con);
 
     // upload GPU assets
-    mjv_makeScene(sceneAssetModel->get_m(), &scn, 2000);
+    mjv_makeScene(sceneAssetModel->get_m(), &scn, sceneCapacity());
     mjr_makeContext(sceneAssetModel->get_m(), &con, mjFONTSCALE_100);
 
     // Set target for the current context and verify the same
@@ -358,7 +1864,7 @@ guiErrCodes MujocoGUI::initInThread(offscreenSize *offSize, bool stopAtOffScreen
         {
             mjv_freeScene(&scn);
             mjr_freeContext(&con);
-            glfwDestroyWindow(window);
+            context->destroy();
             exited = true;
             return OFFSCREEN_TARGET_NOT_SUPPORTED;
         }
@@ -375,30 +1881,97 @@ guiErrCodes MujocoGUI::initInThread(offscreenSize *offSize, bool stopAtOffScreen
             {
                 mjv_freeScene(&scn);
                 mjr_freeContext(&con);
-                glfwDestroyWindow(window);
+                context->destroy();
                 return NO_ERR;
             }
         }
 
+        unsigned tiles = cameraCount();
+        if(tiles > 1)
+        {
+            // camera atlas. grow the framebuffer to hold one tile per camera stacked vertically
+            int atlasHeight = H*static_cast<int>(tiles); // GL sizes are int. tiles is bounded by the model's camera count
+            mjr_resizeOffscreen(W, atlasHeight, &con);
+            mjr_setBuffer(mjFB_OFFSCREEN, &con);
+            if(con.offWidth != W || con.offHeight != atlasHeight)
+            {
+                mjv_freeScene(&scn);
+                mjr_freeContext(&con);
+                context->destroy();
+                exited = true;
+                return OFFSCREEN_TARGET_NOT_SUPPORTED;
+            }
+            viewport = mjr_maxViewport(&con);
+            H = viewport.height;
+        }
+
+        // output size of all the cameras. smaller than the frame with a region of interest or downsampling
+        size_t outPixels = 0;
+        offscreenSize tileSize = {static_cast<unsigned>(H)/tiles, static_cast<unsigned>(W)};
+        for(unsigned tile=0; tile<tiles; tile++)
+        {
+            offscreenSize out = outputSize(tile, tileSize);
+            outPixels += static_cast<size_t>(out.height)*out.width;
+        }
+        isReduced = (outPixels != static_cast<size_t>(W)*H);
+
         // allocate rgb and depth buffers
-        rgb = (unsigned char*) MALLOC(3*W*H, 8);
-        depth = (float*) MALLOC(sizeof(float)*W*H, 8);
+        // front buffers are zeroed since they can be output before the first frame is rendered
+        rgb = (unsigned char*) MALLOC(3*outPixels, 8);
+        depth = (float*) MALLOC(sizeof(float)*outPixels, 8);
+        rgbBack = (unsigned char*) MALLOC(3*outPixels, 8);
+        depthBack = (float*) MALLOC(sizeof(float)*outPixels, 8);
 
-        if( !rgb || !depth )
+        if( !rgb || !depth || !rgbBack || !depthBack )
         {
             if(rgb) FREE(rgb);
             if(depth) FREE(depth);
+            if(rgbBack) FREE(rgbBack);
+            if(depthBack) FREE(depthBack);
             mjv_freeScene(&scn);
             mjr_freeContext(&con);
-            glfwDestroyWindow(window);
+            context->destroy();
 
             exited = true;
             return RGBD_BUFFER_ALLOC_FAILED;
         }
+        memset(rgb, 0, 3*outPixels);
+        memset(depth, 0, sizeof(float)*outPixels);
+        if(isReduced)
+        {
+            rgbFull.resize(3*static_cast<size_t>(W)*H);
+            depthFull.resize(static_cast<size_t>(W)*H);
+            if(pointCloud) pointsFull.resize(3*static_cast<size_t>(W)*H);
+        }
+
+        if(pointCloud)
+        {
+            points = (float*) MALLOC(3*sizeof(float)*outPixels, 8);
+            pointsBack = (float*) MALLOC(3*sizeof(float)*outPixels, 8);
+            if(!points || !pointsBack)
+            {
+                if(points) FREE(points);
+                if(pointsBack) FREE(pointsBack);
+                points = nullptr;
+                pointsBack = nullptr;
+                pointCloud = false;
+            }
+            else
+            {
+                memset(points, 0, 3*sizeof(float)*outPixels);
+            }
+        }
+        initDepthProcessing();
+
+        // fall back to synchronous readback when pixel buffer objects are not available
+        if(asyncReadback && !initAsyncReadback())
+        {
+            asyncReadback = false;
+        }
 
     }
 
-    glfwMakeContextCurrent(NULL);
+    context->releaseCurrent();
     return NO_ERR;
 }
 
@@ -408,7 +1981,7 @@ int MujocoGUI::loopInThread()
     {
         {
             std::lock_guard<std::recursive_mutex> glLock (glfwMutex);
-            if(glfwWindowShouldClose(window)) 
+            if(target == MJ_WINDOW && glfwWindowShouldClose(window)) 
             {
                 // If user clicks on X to close the visualization. Close opengl window but let the simulation continue.
                 releaseInThread();
@@ -416,24 +1989,23 @@ int MujocoGUI::loopInThread()
             }
 
             {
-                glfwMakeContextCurrent(window);
+                context->makeCurrent();
 
-                // modelInstancesLock.lock();
-                for(int index=0; index<mdlInstances.size(); index++)
+                // first model is arbitrarily chosen as the main one.
+                // the dynamic geoms of the remaining instances are added to its scene
+                if(!mdlInstances.empty())
                 {
-                    if(index==0) 
-                    {
-                        refreshScene(mdlInstances[index]);
-                    }
-                    else 
-                    {
-                        addGeomsToScene(mdlInstances[index]);
-                    }
-                    // add remaining dynamic geom locations. 
-                    // first model is arbitrarily chosen as the main one.
+                    refreshScene(mdlInstances[0]);
+                    addInstancesToScene();
+                }
+                if(cameraCount() > 1)
+                {
+                    renderAtlas();
+                }
+                else
+                {
+                    mjr_render(viewport, &scn, &con);
                 }
-                // modelInstancesLock.unlock();
-                mjr_render(viewport, &scn, &con);
                 
                 if(target == MJ_WINDOW)
                 {
@@ -441,13 +2013,19 @@ int MujocoGUI::loopInThread()
                     glfwSwapBuffers(window);
                     glfwPollEvents();
                 }
+                else if(asyncReadback)
+                {
+                    // pixels are mapped in completeReadbackInThread
+                    issueAsyncReadback();
+                }
                 else
                 {   
-                    std::lock_guard<std::mutex> mutLock(camBufferMutex);
-                    mjr_readPixels(rgb, depth, viewport, &con);
+                    // read into the back buffers without blocking readers. then publish by swapping
+                    mjr_readPixels(rgbFrame(), depthFrame(), viewport, &con);
+                    publishBackBuffers();
                 }
                 
-                glfwMakeContextCurrent(NULL);
+                context->releaseCurrent();
             }
         }
         return 0;
@@ -465,15 +2043,22 @@ void MujocoGUI::releaseInThread()
         std::lock_guard<std::recursive_mutex> glLock (glfwMutex);
         if(rgb) FREE(rgb);
         if(depth) FREE(depth);
+        if(rgbBack) FREE(rgbBack);
+        if(depthBack) FREE(depthBack);
+        if(points) FREE(points);
+        if(pointsBack) FREE(pointsBack);
 
-        glfwMakeContextCurrent(window);
+        context->makeCurrent();
+        releaseAsyncReadback();
         mjv_freeScene(&scn);
         mjr_freeContext(&con);
-        glfwDestroyWindow(window); // automatically detaches if current
+        context->destroy(); // automatically detaches if current
         exited = true;
     }
 }
 
+MujocoGUI::MujocoGUI() = default;
+
 MujocoGUI::~MujocoGUI()
 {   
     return;
@@ -488,17 +2073,283 @@ void MujocoGUI::refreshScene(MujocoModelInstance* mi)
     {
         glfwGetFramebufferSize(window, &viewport.width, &viewport.height);
     }
-    mi->dMutex.lock(); // lock before using simulation data
-    mjv_updateScene(mi->get_m(), mi->get_d(), &opt, NULL, &cam, mjCAT_ALL, &scn);
-    mi->dMutex.unlock();
+    // scene is built from the latest published snapshot. physics is not blocked meanwhile
+    // cameras use the state pinned at the time of the request (differs only in pipelined camera mode)
+    mjData *data = (target == MJ_OFFSCREEN) ? mi->getCameraRenderData() : mi->getRenderData();
+    mjv_updateScene(mi->get_m(), data, &opt, NULL, &cam, mjCAT_ALL, &scn);
 }
 void MujocoGUI::addGeomsToScene(MujocoModelInstance* mi)
 {
     // adds additional dynamic bodies to the same visualization.
     // This should help with visualizing parallel simulations on the same window
-    mi->dMutex.lock();
-    mjv_addGeoms(mi->get_m(), mi->get_d(), &opt, NULL, mjCAT_DYNAMIC, &scn);
-    mi->dMutex.unlock();
+    mjv_addGeoms(mi->get_m(), mi->getRenderData(), &opt, NULL, mjCAT_DYNAMIC, &scn);
+}
+
+int MujocoGUI::sceneCapacity()
+{
+    // room for the static scene of the first instance and the dynamic geoms of every instance.
+    // instances are all added before initInThread. geoms beyond the capacity would be dropped silently by mjv_addGeoms
+    size_t capacity = 1000;
+    for(auto mi: mdlInstances)
+    {
+        const mjModel *m = mi->get_m();
+        capacity += m->ngeom + m->nsite + m->nwrap;
+    }
+    return static_cast<int>(std::max<size_t>(capacity, 2000));
+}
+
+void MujocoGUI::addInstancesToScene()
+{
+    // Instances within the budget are added from their latest state (round robin) and their geoms are kept.
+    // The others are drawn from the kept geoms, a copy that costs neither a state fetch nor mjv_addGeoms
+    size_t additional = mdlInstances.size() - 1;
+    if(additional == 0) return;
+    instanceGeoms.resize(additional);
+
+    size_t budget = (instanceBudget == 0 || instanceBudget > additional) ? additional : instanceBudget;
+    size_t firstUpdated = nextInstance % additional;
+    nextInstance = (firstUpdated + budget) % additional;
+
+    for(size_t index=0; index<additional; index++)
+    {
+        std::vector<mjvGeom> &kept = instanceGeoms[index];
+        size_t offset = (index + additional - firstUpdated) % additional; // position in the round robin
+        if(offset < budget || kept.empty())
+        {
+            int start = scn.ngeom;
+            addGeomsToScene(mdlInstances[index+1]);
+            kept.assign(scn.geoms + start, scn.geoms + scn.ngeom);
+        }
+        else
+        {
+            int count = std::min(static_cast<int>(kept.size()), scn.maxgeom - scn.ngeom);
+            for(int geomIndex=0; geomIndex<count; geomIndex++)
+            {
+                scn.geoms[scn.ngeom] = kept[geomIndex];
+                scn.geoms[scn.ngeom].segid = scn.ngeom;
+                scn.ngeom++;
+            }
+        }
+    }
+}
+
+// DEPTH PROCESSING
+void MujocoGUI::initDepthProcessing()
+{
+    // Same clip planes as mj_depth_near_far
+    const mjModel *m = mdlInstances[0]->get_m();
+    double extent = m->stat.extent;
+    depthNear = static_cast<float>(m->vis.map.znear*extent);
+    depthFar = static_cast<float>(m->vis.map.zfar*extent);
+
+    // pinhole model from the vertical field of view (square pixels)
+    int W = viewport.width;
+    int tileHeight = viewport.height/cameraCount();
+    tileFocalInv.resize(cameraCount());
+    for(unsigned tile=0; tile<cameraCount(); tile++)
+    {
+        int id = atlasCamIds.empty() ? camId : atlasCamIds[tile];
+        double fovy = (camType == mjCAMERA_FIXED && id >= 0 && id < m->ncam) ? m->cam_fovy[id] : m->vis.global.fovy;
+        double focal = 0.5*tileHeight/tan(0.5*fovy*mjPI/180.0);
+        tileFocalInv[tile] = static_cast<float>(1.0/focal);
+    }
+
+    // rows are bottom up (glReadPixels order). so y offsets grow upwards like the camera y axis
+    pixelOffsetX.resize(W);
+    pixelOffsetY.resize(tileHeight);
+    for(int col=0; col<W; col++) pixelOffsetX[col] = col + 0.5f - 0.5f*W;
+    for(int row=0; row<tileHeight; row++) pixelOffsetY[row] = row + 0.5f - 0.5f*tileHeight;
+
+    if(pointCloud && !metricDepth) metricScratch.resize(static_cast<size_t>(W)*viewport.height);
+}
+
+void MujocoGUI::processDepth()
+{
+    // The kernels are flat loops over contiguous arrays without aliasing, so the compiler vectorizes them
+    if(!metricDepth && !pointCloud) return;
+
+    int W = viewport.width;
+    int tileHeight = viewport.height/cameraCount();
+    size_t pixelCount = static_cast<size_t>(W)*viewport.height;
+
+    // OpenGL depth d in [0, 1] to metric z. Based on the same reference as mj_depth_near_far
+    const float *__restrict src = depthFrame();
+    float *__restrict z = metricDepth ? depthFrame() : metricScratch.data();
+    const float nearFar = depthNear*depthFar;
+    const float range = depthFar - depthNear;
+    for(size_t index=0; index<pixelCount; index++)
+    {
+        z[index] = nearFar/(depthFar - src[index]*range);
+    }
+
+    if(!pointCloud) return;
+
+    const float *__restrict offsetX = pixelOffsetX.data();
+    for(unsigned tile=0; tile<cameraCount(); tile++)
+    {
+        const float focalInv = tileFocalInv[tile];
+        for(int row=0; row<tileHeight; row++)
+        {
+            size_t rowStart = (static_cast<size_t>(tile)*tileHeight + row)*W;
+            const float *__restrict zRow = z + rowStart;
+            float *__restrict pRow = pointsFrame() + 3*rowStart;
+            const float yScale = pixelOffsetY[row]*focalInv;
+            for(int col=0; col<W; col++)
+            {
+                float depthValue = zRow[col];
+                pRow[3*col] = offsetX[col]*focalInv*depthValue;
+                pRow[3*col+1] = yScale*depthValue;
+                pRow[3*col+2] = -depthValue;
+            }
+        }
+    }
+}
+
+void MujocoGUI::publishBackBuffers()
+{
+    // back buffers hold a complete frame. post process and swap them with the front ones
+    processDepth();
+    if(isReduced) reduceFrame();
+    std::lock_guard<std::mutex> mutLock(camBufferMutex);
+    std::swap(rgb, rgbBack);
+    std::swap(depth, depthBack);
+    std::swap(points, pointsBack);
+}
+
+// REGION OF INTEREST AND DOWNSAMPLING
+offscreenSize MujocoGUI::outputSize(unsigned tile, offscreenSize full)
+{
+    if(tile >= crops.size()) return full;
+    const cameraCrop &crop = crops[tile];
+    unsigned width = std::min(crop.width, full.width);
+    unsigned height = std::min(crop.height, full.height);
+    return {height/crop.factor, width/crop.factor};
+}
+
+unsigned char *MujocoGUI::rgbFrame()
+{
+    return isReduced ? rgbFull.data() : rgbBack;
+}
+
+float *MujocoGUI::depthFrame()
+{
+    return isReduced ? depthFull.data() : depthBack;
+}
+
+float *MujocoGUI::pointsFrame()
+{
+    return isReduced ? pointsFull.data() : pointsBack;
+}
+
+static inline void storeAverage(unsigned char &out, float sum)
+{
+    out = static_cast<unsigned char>(sum + 0.5f);
+}
+
+static inline void storeAverage(float &out, float sum)
+{
+    out = sum;
+}
+
+template <typename T, unsigned CHANNELS>
+static void boxFilter(T *__restrict dst, const T *__restrict src, unsigned srcWidth, unsigned srcRow, unsigned srcCol,
+    offscreenSize out, unsigned factor, float *__restrict rowSum)
+{
+    // Box filter over factor x factor pixels. Rows are summed first (contiguous, vectorizes),
+    //  then every factor columns of the row sum give one output pixel.
+    // src points to the frame, srcRow/srcCol to the bottom left pixel of the region (glReadPixels order)
+    const unsigned span = CHANNELS*out.width*factor;
+    const float scale = 1.0f/(factor*factor);
+    for(unsigned row=0; row<out.height; row++)
+    {
+        for(unsigned index=0; index<span; index++) rowSum[index] = 0;
+        for(unsigned sub=0; sub<factor; sub++)
+        {
+            const T *srcRowPtr = src + CHANNELS*(static_cast<size_t>(srcRow + row*factor + sub)*srcWidth + srcCol);
+            for(unsigned index=0; index<span; index++) rowSum[index] += srcRowPtr[index];
+        }
+
+        T *dstRow = dst + CHANNELS*static_cast<size_t>(row)*out.width;
+        for(unsigned col=0; col<out.width; col++)
+        {
+            for(unsigned ch=0; ch<CHANNELS; ch++)
+            {
+                float sum = 0;
+                for(unsigned sub=0; sub<factor; sub++) sum += rowSum[CHANNELS*(col*factor + sub) + ch];
+                storeAverage(dstRow[CHANNELS*col + ch], sum*scale);
+            }
+        }
+    }
+}
+
+template <typename T, unsigned CHANNELS>
+static void cropRows(T *__restrict dst, const T *__restrict src, unsigned srcWidth, unsigned srcRow, unsigned srcCol,
+    offscreenSize out)
+{
+    for(unsigned row=0; row<out.height; row++)
+    {
+        memcpy(dst + CHANNELS*static_cast<size_t>(row)*out.width,
+            src + CHANNELS*(static_cast<size_t>(srcRow + row)*srcWidth + srcCol), CHANNELS*out.width*sizeof(T));
+    }
+}
+
+template <typename T, unsigned CHANNELS>
+static void reduceRegion(T *dst, const T *src, unsigned srcWidth, unsigned srcRow, unsigned srcCol,
+    offscreenSize out, unsigned factor, std::vector<float> &rowSum)
+{
+    if(factor == 1)
+    {
+        cropRows<T, CHANNELS>(dst, src, srcWidth, srcRow, srcCol, out);
+    }
+    else
+    {
+        rowSum.resize(CHANNELS*out.width*factor);
+        boxFilter<T, CHANNELS>(dst, src, srcWidth, srcRow, srcCol, out, factor, rowSum.data());
+    }
+}
+
+void MujocoGUI::reduceFrame()
+{
+    // full frame -> back buffers. each tile is cropped and downsampled into its own contiguous block
+    unsigned W = viewport.width;
+    unsigned tileHeight = viewport.height/cameraCount();
+    size_t addr = 0;
+    for(unsigned tile=0; tile<cameraCount(); tile++)
+    {
+        offscreenSize out = outputSize(tile, {tileHeight, W});
+        const cameraCrop &crop = crops[tile];
+        // roi is given from the top left. the frame rows are bottom up
+        unsigned srcRow = tile*tileHeight + (tileHeight - crop.y - out.height*crop.factor);
+        unsigned srcCol = crop.x;
+
+        reduceRegion<unsigned char, 3>(rgbBack + 3*addr, rgbFull.data(), W, srcRow, srcCol, out, crop.factor, reduceScratch);
+        reduceRegion<float, 1>(depthBack + addr, depthFull.data(), W, srcRow, srcCol, out, crop.factor, reduceScratch);
+        if(pointCloud)
+        {
+            reduceRegion<float, 3>(pointsBack + 3*addr, pointsFull.data(), W, srcRow, srcCol, out, crop.factor, reduceScratch);
+        }
+        addr += static_cast<size_t>(out.height)*out.width;
+    }
+}
+
+void MujocoGUI::renderAtlas()
+{
+    // scene geometry is the same for all cameras of the model. only the camera changes per tile
+    MujocoModelInstance *mi = mdlInstances[0];
+    mjData *data = mi->getCameraRenderData();
+    int tileHeight = viewport.height/cameraCount();
+    for(unsigned tile=0; tile<cameraCount(); tile++)
+    {
+        cam.fixedcamid = atlasCamIds[tile];
+        mjv_updateCamera(mi->get_m(), data, &cam, &scn);
+        mjrRect tileViewport = {0, static_cast<int>(tile)*tileHeight, viewport.width, tileHeight};
+        mjr_render(tileViewport, &scn, &con);
+    }
+}
+
+unsigned MujocoGUI::cameraCount()
+{
+    return atlasCamIds.empty() ? 1 : static_cast<unsigned>(atlasCamIds.size());
 }
 
 void MujocoGUI::addMi(shared_ptr<MujocoModelInstance> mdlInstance)
@@ -17,6 +17,11 @@
 #include <atomic>
 #include <memory>
 #include "semaphore.hpp"
+#include "triplebuffer.hpp"
+#include "framerecorder.hpp"
+#include "statelogger.hpp"
+#include "perfcounters.hpp"
+#include "threadpool.hpp"
 
 // using namespace std::chrono_literals;
 
@@ -28,6 +33,7 @@ class sensorInterface
     std::vector<std::string> names;
     std::vector<unsigned> dim;
     std::vector<unsigned> addr;
+    bool isContiguous = true; // sensors are packed back to back in sensordata in the same order as names
 
     std::size_t hash();
 };
@@ -47,6 +53,18 @@ struct offscreenSize
     unsigned width;
 };
 
+struct cameraCrop
+{
+    // Region of interest in pixels of the offscreen image (origin at the top left) and integer downsampling factor.
+    // Read from the model's custom numeric fields camera_roi_<camera name> = "x y width height" and
+    //  camera_downsample_<camera name> = "factor". The output is (height/factor) x (width/factor).
+    unsigned x = 0;
+    unsigned y = 0;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned factor = 1;
+};
+
 class cameraInterface
 {
     public:
@@ -61,15 +79,114 @@ class cameraInterface
     std::size_t hash();
 };
 
+struct visualState
+{
+    // minimal simulation state needed to rebuild a scene
+    mjtNum time = 0;
+    std::vector<mjtNum> qpos;
+    std::vector<mjtNum> mocap_pos;
+    std::vector<mjtNum> mocap_quat;
+    std::vector<mjtNum> ctrl; // actuator and tendon colors (mjVIS_ACTIVATION)
+    std::vector<mjtNum> act;
+};
+
+enum cameraSampleStatus
+{
+    CAMERA_NOT_DUE = 0, // the camera sample time has not elapsed since the last request
+    CAMERA_REQUESTED,   // pipelined cameras: the first frame is rendering, nothing to output yet
+    CAMERA_COLLECTED    // a frame is available. copy it with copyCameraFrame
+};
+
+enum ctrlInterpolation
+{
+    CTRL_ZOH = 0, // hold the new control for all substeps
+    CTRL_FOH      // ramp linearly from the previous control to the new one across substeps
+};
+
+enum glTarget
+{
+    MJ_WINDOW = 0,
+    MJ_OFFSCREEN
+};
+enum guiErrCodes
+{
+    NO_ERR = 0,
+    UNKNOWN_TARGET,
+    WINDOW_CREATION_FAILED,
+    OFFSCREEN_TARGET_NOT_SUPPORTED,
+    RGBD_BUFFER_ALLOC_FAILED,
+    GLFW_INIT_FAILED,
+    GL_BACKEND_NOT_AVAILABLE, // backend was not compiled in (see MJ_EGL/MJ_OSMESA in tools/Makefile)
+    GL_CONTEXT_CREATION_FAILED,
+    FRAME_RECORDER_OPEN_FAILED // recordFrames file could not be created
+};
+
+enum glBackendType
+{
+    MJ_GL_GLFW = 0, // hidden GLFW window. needs a display server
+    MJ_GL_EGL,      // headless (GPU or Mesa)
+    MJ_GL_OSMESA    // headless software rendering
+};
+
+// Parses "glfw", "egl" or "osmesa". Returns false for anything else
+bool parseGlBackend(const std::string &name, glBackendType &backend);
+// Backend for offscreen rendering when none is selected explicitly. Taken from MUJOCO_GL environment variable (default glfw)
+glBackendType defaultGlBackend();
+
+class glContext
+{
+    // OpenGL context (and default framebuffer) behind a MujocoGUI.
+    // Windows are always GLFW. Offscreen buffers render into MuJoCo's own framebuffer and can use any backend.
+    public:
+    virtual ~glContext() = default;
+    virtual guiErrCodes create(glTarget target) = 0;
+    virtual void makeCurrent() = 0;
+    virtual void releaseCurrent() = 0;
+    virtual void destroy() = 0;
+    virtual void *getProcAddress(const char *name) = 0;
+    virtual GLFWwindow *getWindow() { return NULL; }
+};
+
+std::unique_ptr<glContext> makeGlContext(glBackendType backend); // NULL if the backend is not compiled in
+
+// Hash of the model XML, its includes and its asset files (and the MuJoCo version). False if the model can not be read
+bool modelContentHash(const std::string &file, uint64_t &hash);
+
 class MujocoGUI;
 class MujocoModelInstance
 {
     // This class is not designed to be moved or copied
 private:
     mjData *d = NULL;
-    mjModel *m = NULL;
+    mjModel *m = NULL; // read only. shared by all instances of the same file (see model registry in mj.cpp)
+    std::shared_ptr<mjModel> sharedModel;
+
+    // control staging for sub stepping. Sized in initData
+    std::vector<mjtNum> ctrlTarget;
+    std::vector<mjtNum> ctrlPrevious;
+    bool hasPreviousCtrl = false;
+
+    // Physics publishes the visual state after every step. The renderer rebuilds kinematics in its own mjData
+    // so that step() never waits on scene generation
+    tripleBuffer<visualState> visualBuffer;
+    mjData *renderData = NULL;
+    void publishVisualState();
+    void storeVisualState(visualState &state);
+    void loadVisualState(const visualState &state, mjData *data);
+
+    // state captured at the last pipelined camera request
+    visualState cameraState;
+    mjData *cameraRenderData = NULL;
+    unsigned long cameraStateCaptured = 0; // written before the request is signalled
+    unsigned long cameraStateLoaded = 0; // render thread only
+
+    // state of the last camera render, for skipping unchanged scenes. render thread only
+    visualState lastCameraState;
+    bool hasLastCameraState = false; // false - the next request always renders (start, reset, restored state)
+    bool isRenderDataStale = false; // a newer visual state was fetched but not loaded into renderData yet
 
     int initCameras();
+    cameraCrop getCameraCrop(int camId);
 
     controlInterface getControlInterface();
     sensorInterface getSensorInterface();
@@ -82,6 +199,12 @@ public:
 
     // cameras in the model instance
     std::vector<std::shared_ptr<MujocoGUI>> offscreenCam;
+    glBackendType offscreenBackend = defaultGlBackend(); // set before initMdl
+    bool cameraAtlas = false; // render all cameras into one framebuffer with a single readback. set before initMdl
+    bool cameraAsyncReadback = false; // read camera pixels through pixel buffer objects. set before initMdl
+    bool cameraMetricDepth = false; // output depth in meters instead of the OpenGL depth buffer value. set before initMdl
+    bool cameraPointCloud = false; // compute an organized point cloud for every camera. set before initMdl
+    bool cameraMatlabLayout = false; // camera outputs in MATLAB H x W x channels column major layout (top row first)
     
     // enable default contructor
     MujocoModelInstance() = default;
@@ -90,6 +213,13 @@ public:
     int initMdl(std::string file, bool shouldInitCam = true, bool shouldGetCami = true);
     int initData();
 
+    // Operating point. Physics state (mjSTATE_INTEGRATION), control interpolation state and camera timing
+    //  as one vector of doubles. setOperatingPoint returns -1 when the vector does not match this model.
+    // Join any deferred step and consume any in flight camera request before calling these.
+    std::vector<double> getOperatingPoint();
+    int setOperatingPoint(const double *point, size_t length);
+    void resetState(); // back to the initial state (start of every run, incl. fast restart runs)
+
     // Cache for internal usage
     controlInterface ci;
     sensorInterface si;
@@ -102,34 +232,85 @@ public:
     mjModel *get_m();
     mjData *get_d();
 
+    // Render thread only. Latest published state with kinematics (positions, cameras, lights, tendons) computed
+    mjData *getRenderData();
+
 
     // Camera timing
     double lastRenderTime = 0;
     double cameraRenderInterval = 0.020;
     std::atomic<bool> isCameraDataNew = false;
     binarySemp cameraSync; // semp for syncing main thread and render camera thread
+
+    // Camera frame recording. Frames are handed from the rendering thread to the recorder's writer thread
+    std::string frameRecordPath; // empty - recording off. set before the rendering thread starts
+    std::unique_ptr<frameRecorder> frameLog;
+    bool startFrameRecording(); // rendering thread, after cami is known
+    void recordFrame(double time); // rendering thread, after a camera render
+    double readbackFrameTime = 0; // rendering thread. camera time of the frame whose asynchronous readback is pending
     std::atomic<bool> shouldCameraRenderNow = false;
 
-    void step(std::vector<double> u);
+    // Pipelined camera mode. The render requested at a camera sample overlaps the physics steps that follow
+    //  and its frame is output at the next camera sample. i.e. camera output has a fixed latency of one camera sample time.
+    bool cameraPipelined = false;
+    bool isCameraRequestInFlight = false; // accessed only from the thread that requests renders
+    int enableCameraPipeline();
+    void captureCameraState(); // call before setting shouldCameraRenderNow
+    mjData *getCameraRenderData(); // render thread only
+
+    // Camera render skipping. When nothing visible moved (qpos and mocap poses within cameraChangeTolerance)
+    //  since the last render, the previous frame is kept and the render and readback are skipped.
+    bool cameraSkipUnchanged = false; // set before the simulation starts
+    mjtNum cameraChangeTolerance = 0;
+    std::atomic<unsigned long long> cameraSkipCount{0}; // since the last resetState
+    bool shouldRenderCameras(); // render thread only. call once per camera request
+
+    // Rendering thread steps shared by the S-Function and mj_bench. traceIndex tags the trace events of this instance
+    guiErrCodes initRenderingInThread(); // offscreen cameras, cami and frame recording. returns the last error
+    void serveCameraRequestInThread(int traceIndex); // renders (or skips) a pending camera request and signals cameraSync
+    void releaseRenderingInThread();
+
+    // Sub stepping. One step() advances the physics by substeps*opt.timestep under a single lock
+    unsigned substeps = 1;
+    ctrlInterpolation interp = CTRL_ZOH;
+
+    // Stepping is allocation free. u holds nu controls (extra ones are ignored).
+    // The pointer-to-pointer form matches Simulink's InputRealPtrsType and avoids an intermediate copy.
+    void step(const double *u, unsigned nu);
+    void step(const double *const *uPtrs, unsigned nu);
+
+    // Split form of step for deferred (thread pool) stepping.
+    // setControl copies the port values synchronously, step() can then run on any thread.
+    void setControl(const double *u, unsigned nu);
+    void setControl(const double *const *uPtrs, unsigned nu);
+    void step();
+    binarySemp stepDone; // released by the worker once a deferred step is complete
+
+    // Block steps shared by the S-Function and mj_bench (mdlUpdate/mdlOutputs). traceIndex tags the trace events
+    void stepInPool(workStealingPool &pool, const double *u, unsigned nu); // setControl now, step() on the pool
+    void stepInPool(workStealingPool &pool, const double *const *uPtrs, unsigned nu);
+    bool joinPendingStep(int traceIndex); // waits for the step queued by stepInPool. false when none was pending
+    void quiesce(); // joins the pending step and the pipelined camera request (if any)
+    cameraSampleStatus requestCameraSample(eventSignal &renderWakeup, int traceIndex); // call once per mdlOutputs
+    bool copyCameraFrame(uint8_t *rgb, float *depth, float *points, int traceIndex); // only if the collected frame is new. points may be null
+
+    // State logging. Selected mjData fields are recorded after every mj_step (i.e. every substep).
+    // fieldList is space separated, e.g. "qpos qvel ctrl sensordata". Returns 0, -1 for an unknown field
+    //  or -2 when the file cannot be created. Call after initData
+    std::unique_ptr<stateLogger> stateLog;
+    int startStateLogging(const std::string &path, const std::string &fieldList);
+    bool isStepPending = false; // accessed only from the thread that queues the step
+
+    // Hot path timing (step, dMutex wait, camera wait/copy, render). Disabled unless perf.enabled is set
+    perfCounters perf;
     std::vector<double> getSensor(unsigned index);
+    size_t getSensors(double *buffer); // copies all sensors (in si order) under a single lock. returns scalar count
     size_t getCameraRGB(uint8_t *buffer);
     void getCameraDepth(float *buffer);
+    void getCameraPointCloud(float *buffer); // 3 floats (xyz) per depth pixel
 };
 
-enum glTarget
-{
-    MJ_WINDOW = 0,
-    MJ_OFFSCREEN
-};
-enum guiErrCodes
-{
-    NO_ERR = 0,
-    UNKNOWN_TARGET,
-    WINDOW_CREATION_FAILED,
-    OFFSCREEN_TARGET_NOT_SUPPORTED,
-    RGBD_BUFFER_ALLOC_FAILED,
-    GLFW_INIT_FAILED
-};
+struct pixelBufferReadback; // GL state for asynchronous readback (defined in mj.cpp)
 
 class MujocoGUI
 {
@@ -141,10 +322,47 @@ class MujocoGUI
     mjrContext con;
     mjrRect viewport = {0, 0, 0, 0};
     glTarget target;
+    std::unique_ptr<glContext> context;
 
     // adding content to a scene based on current simulation state
     void refreshScene(MujocoModelInstance* mdlInstance);
     void addGeomsToScene(MujocoModelInstance* mdlInstance);
+    void renderAtlas();
+
+    // windows shared by many instances (Global rendering)
+    std::vector<std::vector<mjvGeom>> instanceGeoms; // geoms of every additional instance at its last update
+    size_t nextInstance = 0; // round robin position among the additional instances
+    int sceneCapacity();
+    void addInstancesToScene();
+
+    // asynchronous readback. pixels are read into a pixel buffer object and mapped later
+    std::unique_ptr<pixelBufferReadback> pbo;
+    bool initAsyncReadback();
+    void issueAsyncReadback();
+    int mapReadback(unsigned index);
+    void releaseAsyncReadback();
+
+    // depth post processing. runs on the back buffers in the render thread
+    float depthNear = 0;
+    float depthFar = 0;
+    std::vector<float> tileFocalInv; // 1/focal length (pixels) of every tile
+    std::vector<float> pixelOffsetX; // pixel center offsets from the optical axis
+    std::vector<float> pixelOffsetY;
+    std::vector<float> metricScratch; // metric depth when the depth output itself stays nonlinear
+    void initDepthProcessing();
+    void processDepth();
+    void publishBackBuffers();
+
+    // full frame buffers, used when a region of interest or downsampling is set
+    bool isReduced = false;
+    std::vector<unsigned char> rgbFull;
+    std::vector<float> depthFull;
+    std::vector<float> pointsFull;
+    std::vector<float> reduceScratch; // box filter row sums
+    unsigned char *rgbFrame(); // where the frame is read into
+    float *depthFrame();
+    float *pointsFrame();
+    void reduceFrame();
     
     public:
     GLFWwindow *window; // exposed for window callback management
@@ -157,17 +375,55 @@ class MujocoGUI
     MujocoModelInstance* sceneAssetModel;
 
     // rgb and depth buffers for offscreen rendering
+    // Pixels are read into the back buffers and swapped with the front ones under camBufferMutex.
+    // Readers only ever see the front (complete) frame.
     std::mutex camBufferMutex;
     unsigned char* rgb = nullptr;
     float* depth = nullptr;
+    unsigned char* rgbBack = nullptr;
+    float* depthBack = nullptr;
+
+    // Depth post processing (offscreen only). Set before initInThread
+    // metricDepth converts depth to the distance along the optical axis in meters.
+    // pointCloud fills points with xyz per pixel in the camera frame (x right, y up, camera looks along -z).
+    bool metricDepth = false;
+    bool pointCloud = false;
+    float* points = nullptr;
+    float* pointsBack = nullptr;
 
     // camera spec
     mjtCamera camType;
     int camId;
 
+    // Camera atlas (offscreen only). When set, every listed fixed camera is rendered into its own tile of one framebuffer.
+    // Tiles are stacked bottom up so that each camera is contiguous in rgb/depth, in the same layout as the concatenated outputs.
+    std::vector<int> atlasCamIds;
+    unsigned cameraCount(); // number of cameras rendered by this object
+
+    // Region of interest and downsampling of every camera (offscreen only). Set before initInThread.
+    // rgb/depth/points hold the reduced images back to back, the full frame is kept in a separate buffer.
+    std::vector<cameraCrop> crops;
+    offscreenSize outputSize(unsigned tile, offscreenSize full);
+
+    // Offscreen only. loopInThread starts the pixel transfer of the frame, and completeReadbackInThread maps the frame of
+    //  the previous request into rgb/depth. The transfer overlaps everything until the next request, at the cost of one
+    //  request of latency. flushReadbackInThread maps every pending frame (when no new frame is rendered).
+    bool asyncReadback = false;
+    std::atomic<bool> discardPendingReadback = false; // set when the simulation restarts. pending frames are dropped
+    int completeReadbackInThread();
+    int flushReadbackInThread();
+
+    // GL backend for offscreen targets. Set before initInThread
+    glBackendType backend = MJ_GL_GLFW;
+
     std::atomic<bool> exited = false;
     std::mutex modelInstancesLock;
 
+    // Additional instances (all but the first) whose geoms are updated per window frame. 0 updates all of them.
+    // The others are drawn at their last update, so every instance is refreshed at least every
+    //  ceil((instances-1)/instanceBudget) frames. Set before initInThread
+    unsigned instanceBudget = 0;
+
     // Timing 
     bool isVsyncOn = false;
     std::chrono::microseconds renderInterval;
@@ -190,6 +446,10 @@ class MujocoGUI
 
     public:
     // Enable default constructior and destructor
-    MujocoGUI() = default;
+    MujocoGUI();
     ~MujocoGUI();
 };
+
+// Rendering thread. Renders the windows whose frame is due and returns when the next frame of an open window is due
+//  (time_point::max() when there is none)
+std::chrono::steady_clock::time_point renderWindowsInThread(std::vector<std::shared_ptr<MujocoGUI>> &windows);
@@ -0,0 +1,198 @@
+// Model introspection for the block mask. Loads the model once and returns everything the mask needs,
+//  info = mj_model_info_mex(xmlPath)
+// info has the bus names (controlBus, sensorBus, rgbBus, depthBus), lengths ([control; sensor; rgb; depth] uint32),
+//  sampleTime, znear and zfar.
+//  1. The generated buses are named uniquely using std::hash. Existing buses are not regenerated
+//  2. Results are cached in this process keyed by a hash of the model content (XML, includes and assets).
+//     A cache hit does not load the model again
+//  3. Bus existence checks and bus creation happen in one call to mj_busCreate
+
+// MATLAB and Simulink are registered trademarks of The MathWorks, Inc.
+// Copyright 2022-2023 The MathWorks, Inc.
+
+#include "mex.hpp"
+#include "mexAdapter.hpp"
+#include "MatlabDataArray.hpp"
+#include "mj.hpp"
+#include <map>
+#include <mutex>
+
+static std::mutex mut;
+
+class MexFunction: public matlab::mex::Function
+{
+    private:
+    std::shared_ptr<matlab::engine::MATLABEngine> matlabPtr = getEngine();
+    matlab::data::ArrayFactory af;
+
+    // model content hash -> {bus names, bus structs, info}. Lives until the MEX is cleared
+    std::map<uint64_t, std::vector<matlab::data::Array>> modelCache;
+
+    public:
+
+    void operator()
+    (matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs)
+    {
+        // serialize this function as it accesses files and base workspace
+        std::lock_guard<std::mutex> lock(mut);
+
+        using namespace matlab::data;
+        using namespace matlab::mex;
+        using namespace matlab::engine;
+
+        if(inputs.size() != 1)
+        {
+            printError("Expected 1 input");
+        }
+
+        std::string pathStr;
+        if(inputs[0].getType() == ArrayType::CHAR)
+        {
+            CharArray path = inputs[0];
+            pathStr = path.toAscii();
+        }
+        else
+        {
+            printError("Only char array allowed as input");
+        }
+
+        uint64_t key = 0;
+        bool isHashed = modelContentHash(pathStr, key);
+        auto cached = isHashed ? modelCache.find(key) : modelCache.end();
+        if(cached == modelCache.end())
+        {
+            std::vector<Array> entry = loadModelInfo(pathStr);
+            if(!isHashed)
+            {
+                createBuses(entry[0], entry[1]);
+                outputs[0] = entry[2];
+                return;
+            }
+            cached = modelCache.emplace(key, std::move(entry)).first;
+        }
+
+        // buses may have been cleared from the base workspace since the last call
+        createBuses(cached->second[0], cached->second[1]);
+        outputs[0] = cached->second[2];
+    }
+
+    std::vector<matlab::data::Array> loadModelInfo(const std::string &pathStr)
+    {
+        using namespace matlab::data;
+
+        std::shared_ptr<MujocoModelInstance> mi = std::make_shared<MujocoModelInstance>();
+        if(mi->initMdl(pathStr) != 0)
+        {
+            printError("Unable to load file");
+        }
+
+        auto ci = mi->ci;
+        auto si = mi->si;
+        auto cami = mi->cami;
+
+        CellArray busNames = af.createCellArray({1, 4});
+        CellArray busStructs = af.createCellArray({1, 4});
+        std::vector<std::string> names = {"mj_bus_input_" + std::to_string(ci.hash()),
+                                          "mj_bus_sensor_" + std::to_string(si.hash()),
+                                          "mj_bus_rgb_" + std::to_string(cami.hash()),
+                                          "mj_bus_depth_" + std::to_string(cami.hash())};
+        for(size_t index=0; index<names.size(); index++)
+        {
+            busNames[0][index] = af.createCharArray(names[index]);
+        }
+        busStructs[0][0] = inputBusStruct(ci);
+        busStructs[0][1] = sensorBusStruct(si);
+        busStructs[0][2] = rgbBusStruct(cami);
+        busStructs[0][3] = depthBusStruct(cami);
+
+        // https://github.com/deepmind/dm_control/blob/20cef21e2554592cd7fad0bb32c169aff2fe72bc/dm_control/mujoco/engine.py#L861
+        double extent = mi->get_m()->stat.extent;
+        double znear = mi->get_m()->vis.map.znear*extent;
+        double zfar = mi->get_m()->vis.map.zfar*extent;
+
+        StructArray info = af.createStructArray({1, 1},
+            {"controlBus", "sensorBus", "rgbBus", "depthBus", "lengths", "sampleTime", "znear", "zfar"});
+        info[0]["controlBus"] = af.createCharArray(names[0]);
+        info[0]["sensorBus"] = af.createCharArray(names[1]);
+        info[0]["rgbBus"] = af.createCharArray(names[2]);
+        info[0]["depthBus"] = af.createCharArray(names[3]);
+        info[0]["lengths"] = af.createArray<uint32_t>({4, 1}, {ci.count, si.scalarCount, cami.rgbLength, cami.depthLength});
+        info[0]["sampleTime"] = af.createScalar(mi->getSampleTime());
+        info[0]["znear"] = af.createScalar(znear);
+        info[0]["zfar"] = af.createScalar(zfar);
+
+        mi.reset();
+        glfwTerminate();
+
+        return {busNames, busStructs, info};
+    }
+
+    matlab::data::StructArray sensorBusStruct(sensorInterface si)
+    {
+        using namespace matlab::data;
+
+        StructArray busStruct = af.createStructArray({1}, si.names);
+        for(unsigned int index=0; index<si.count; index++)
+        {
+            std::string name = si.names[index];
+            ArrayDimensions sensorDim{si.dim[index],1};
+            busStruct[0][name] = af.createArray<double>(sensorDim);
+        }
+        return busStruct;
+    }
+
+    matlab::data::StructArray inputBusStruct(controlInterface ci)
+    {
+        using namespace matlab::data;
+
+        StructArray busStruct = af.createStructArray({1}, ci.names);
+        for(unsigned int index=0; index<ci.count; index++)
+        {
+            std::string name = ci.names[index];
+            busStruct[0][name] = af.createArray<double>({1,1});
+        }
+        return busStruct;
+    }
+
+    matlab::data::StructArray rgbBusStruct(cameraInterface cami)
+    {
+        using namespace matlab::data;
+
+        StructArray busStruct = af.createStructArray({1}, cami.names);
+        for(unsigned int index=0; index<cami.count; index++)
+        {
+            std::string name = cami.names[index];
+            ArrayDimensions outputDim{cami.size[index].height, cami.size[index].width, 3};
+            busStruct[0][name] = af.createArray<uint8_t>(outputDim);
+        }
+        return busStruct;
+    }
+
+    matlab::data::StructArray depthBusStruct(cameraInterface cami)
+    {
+        using namespace matlab::data;
+
+        StructArray busStruct = af.createStructArray({1}, cami.names);
+        for(unsigned int index=0; index<cami.count; index++)
+        {
+            std::string name = cami.names[index];
+            ArrayDimensions outputDim{cami.size[index].height, cami.size[index].width};
+            busStruct[0][name] = af.createArray<float>(outputDim);
+        }
+        return busStruct;
+    }
+
+    void createBuses(matlab::data::Array busNames, matlab::data::Array busStructs)
+    {
+        // single round trip. mj_busCreate skips the buses that already exist
+        matlabPtr->feval(u"mj_busCreate", 0, std::vector<matlab::data::Array>({busNames, busStructs}));
+    }
+
+    void printError(std::string err)
+    {
+        matlabPtr->feval(u"error", 0,
+                std::vector<matlab::data::Array>(
+                    { af.createScalar(err) }));
+    }
+
+};
@@ -0,0 +1,153 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#include "mex.hpp"
+#include "mexAdapter.hpp"
+#include "MatlabDataArray.hpp"
+#include "framerecorder.hpp"
+#include <fstream>
+
+// Random access reader for camera frame files written with the recordFrames option.
+//  info = mj_read_frames(file)
+//  [rgb, depth, time, index] = mj_read_frames(file, frames)
+// frames are 1 based. rgb is rgbLength x numel(frames) uint8 and depth is depthLength x numel(frames) single,
+//  each column laid out like the block's rgb and depth outputs (see info.cameras for the per camera slices).
+
+class MexFunction: public matlab::mex::Function
+{
+    private:
+    std::shared_ptr<matlab::engine::MATLABEngine> matlabPtr = getEngine();
+    matlab::data::ArrayFactory af;
+
+    public:
+    void operator()
+    (matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs)
+    {
+        using namespace matlab::data;
+        using namespace matlab::mex;
+        using namespace matlab::engine;
+
+        if(inputs.size() != 1 && inputs.size() != 2)
+        {
+            printError("1 or 2 inputs expected");
+        }
+
+        std::string pathStr;
+        if(inputs[0].getType() == ArrayType::CHAR)
+        {
+            CharArray path = inputs[0];
+            pathStr = path.toAscii();
+        }
+        else
+        {
+            printError("Only char array allowed as file name");
+        }
+
+        std::ifstream file(pathStr, std::ios::binary);
+        if(!file)
+        {
+            printError("Unable to open " + pathStr);
+        }
+
+        frameFileHeader header;
+        file.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if(!file || memcmp(header.magic, FRAME_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != FRAME_FILE_VERSION)
+        {
+            printError("Not a camera frame file (or unsupported version)");
+        }
+
+        std::vector<frameFileCamera> cameras(header.cameraCount);
+        if(header.cameraCount > 0)
+        {
+            file.read(reinterpret_cast<char *>(cameras.data()), sizeof(frameFileCamera)*cameras.size());
+        }
+
+        // frame count from the file size, so that a file of a crashed simulation is still readable
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+        uint64_t frameCount = (fileSize > header.dataOffset) ? (fileSize - header.dataOffset)/header.frameSize : 0;
+
+        if(inputs.size() == 1)
+        {
+            outputs[0] = infoStruct(header, cameras, frameCount);
+            return;
+        }
+
+        if(inputs[1].getType() != ArrayType::DOUBLE)
+        {
+            printError("Frame indices must be double");
+        }
+        TypedArray<double> frames = inputs[1];
+        size_t count = frames.getNumberOfElements();
+
+        buffer_ptr_t<uint8_t> rgb = af.createBuffer<uint8_t>(header.rgbLength*count);
+        buffer_ptr_t<float> depth = af.createBuffer<float>(header.depthLength*count);
+        buffer_ptr_t<double> time = af.createBuffer<double>(count);
+        buffer_ptr_t<double> index = af.createBuffer<double>(count);
+
+        size_t column = 0;
+        for(double frameNumber: frames)
+        {
+            if(frameNumber < 1 || frameNumber > frameCount || frameNumber != static_cast<uint64_t>(frameNumber))
+            {
+                printError("Frame index out of range. File has " + std::to_string(frameCount) + " frames");
+            }
+
+            // fixed size records. no scan needed
+            uint64_t offset = header.dataOffset + (static_cast<uint64_t>(frameNumber) - 1)*header.frameSize;
+            file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+
+            frameRecordHeader record;
+            file.read(reinterpret_cast<char *>(&record), sizeof(record));
+            file.read(reinterpret_cast<char *>(rgb.get() + column*header.rgbLength), header.rgbLength);
+            file.read(reinterpret_cast<char *>(depth.get() + column*header.depthLength), sizeof(float)*header.depthLength);
+            if(!file)
+            {
+                printError("Unable to read frame " + std::to_string(static_cast<uint64_t>(frameNumber)));
+            }
+            time.get()[column] = record.time;
+            index.get()[column] = static_cast<double>(record.index + 1);
+            column++;
+        }
+
+        outputs[0] = af.createArrayFromBuffer<uint8_t>({static_cast<size_t>(header.rgbLength), count}, std::move(rgb));
+        if(outputs.size() > 1) outputs[1] = af.createArrayFromBuffer<float>({static_cast<size_t>(header.depthLength), count}, std::move(depth));
+        if(outputs.size() > 2) outputs[2] = af.createArrayFromBuffer<double>({count, 1}, std::move(time));
+        if(outputs.size() > 3) outputs[3] = af.createArrayFromBuffer<double>({count, 1}, std::move(index));
+    }
+
+    matlab::data::StructArray infoStruct(const frameFileHeader &header, const std::vector<frameFileCamera> &cameras, uint64_t frameCount)
+    {
+        using namespace matlab::data;
+
+        StructArray cameraStruct = af.createStructArray({cameras.size(), 1}, {"name", "height", "width", "rgbAddr", "depthAddr"});
+        uint64_t rgbAddr = 0;
+        uint64_t depthAddr = 0;
+        for(size_t index=0; index<cameras.size(); index++)
+        {
+            std::string name(cameras[index].name, strnlen(cameras[index].name, FRAME_FILE_NAME_LENGTH));
+            cameraStruct[index]["name"] = af.createCharArray(name);
+            cameraStruct[index]["height"] = af.createScalar<double>(cameras[index].height);
+            cameraStruct[index]["width"] = af.createScalar<double>(cameras[index].width);
+            // 1 based start of the camera within an rgb/depth column
+            cameraStruct[index]["rgbAddr"] = af.createScalar<double>(static_cast<double>(rgbAddr + 1));
+            cameraStruct[index]["depthAddr"] = af.createScalar<double>(static_cast<double>(depthAddr + 1));
+            rgbAddr += 3*static_cast<uint64_t>(cameras[index].height)*cameras[index].width;
+            depthAddr += static_cast<uint64_t>(cameras[index].height)*cameras[index].width;
+        }
+
+        StructArray info = af.createStructArray({1, 1}, {"frameCount", "layout", "rgbLength", "depthLength", "cameras"});
+        info[0]["frameCount"] = af.createScalar<double>(static_cast<double>(frameCount));
+        info[0]["layout"] = af.createCharArray(header.layout ? "matlab" : "opengl");
+        info[0]["rgbLength"] = af.createScalar<double>(static_cast<double>(header.rgbLength));
+        info[0]["depthLength"] = af.createScalar<double>(static_cast<double>(header.depthLength));
+        info[0]["cameras"] = cameraStruct;
+        return info;
+    }
+
+    void printError(std::string err)
+    {
+        matlabPtr->feval(u"error", 0,
+                std::vector<matlab::data::Array>(
+                    { af.createScalar(err) }));
+    }
+
+};
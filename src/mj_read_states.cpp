@@ -0,0 +1,126 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#include "mex.hpp"
+#include "mexAdapter.hpp"
+#include "MatlabDataArray.hpp"
+#include "statelogger.hpp"
+#include <fstream>
+
+// Reader for state log files written with the logState option.
+//  log = mj_read_states(file)
+// log has one field per logged mjData field (samples x width double) plus time (samples x 1)
+//  and droppedSamples (samples lost while logging).
+
+class MexFunction: public matlab::mex::Function
+{
+    private:
+    std::shared_ptr<matlab::engine::MATLABEngine> matlabPtr = getEngine();
+    matlab::data::ArrayFactory af;
+
+    public:
+    void operator()
+    (matlab::mex::ArgumentList outputs, matlab::mex::ArgumentList inputs)
+    {
+        using namespace matlab::data;
+        using namespace matlab::mex;
+        using namespace matlab::engine;
+
+        if(inputs.size() != 1)
+        {
+            printError("1 input expected");
+        }
+
+        std::string pathStr;
+        if(inputs[0].getType() == ArrayType::CHAR)
+        {
+            CharArray path = inputs[0];
+            pathStr = path.toAscii();
+        }
+        else
+        {
+            printError("Only char array allowed as file name");
+        }
+
+        std::ifstream file(pathStr, std::ios::binary);
+        if(!file)
+        {
+            printError("Unable to open " + pathStr);
+        }
+
+        stateFileHeader header;
+        file.read(reinterpret_cast<char *>(&header), sizeof(header));
+        if(!file || memcmp(header.magic, STATE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != STATE_FILE_VERSION)
+        {
+            printError("Not a state log file (or unsupported version)");
+        }
+
+        std::vector<stateFileField> fields(header.fieldCount);
+        file.read(reinterpret_cast<char *>(fields.data()), sizeof(stateFileField)*fields.size());
+        size_t recordLength = 0;
+        for(auto &field: fields) recordLength += field.width;
+        std::streamoff dataStart = file.tellg();
+
+        // first pass. count the samples of the complete blocks (a crashed run may leave a partial block behind)
+        uint64_t rows = 0;
+        stateBlockHeader block;
+        while(file.read(reinterpret_cast<char *>(&block), sizeof(block)))
+        {
+            std::streamoff blockBytes = static_cast<std::streamoff>(block.rows)*recordLength*sizeof(double);
+            std::streamoff next = file.tellg() + blockBytes;
+            file.seekg(0, std::ios::end);
+            if(file.tellg() < next) break;
+            file.seekg(next, std::ios::beg);
+            rows += block.rows;
+        }
+
+        // second pass. every block column lands in its place of the (rows x width) output
+        std::vector<buffer_ptr_t<double>> buffers;
+        for(auto &field: fields)
+        {
+            buffers.push_back(af.createBuffer<double>(static_cast<size_t>(rows)*field.width));
+        }
+
+        file.clear();
+        file.seekg(dataStart, std::ios::beg);
+        uint64_t rowStart = 0;
+        while(rowStart < rows && file.read(reinterpret_cast<char *>(&block), sizeof(block)))
+        {
+            for(size_t fieldIndex=0; fieldIndex<fields.size(); fieldIndex++)
+            {
+                for(uint32_t element=0; element<fields[fieldIndex].width; element++)
+                {
+                    double *destination = buffers[fieldIndex].get() + element*rows + rowStart;
+                    file.read(reinterpret_cast<char *>(destination), sizeof(double)*block.rows);
+                }
+            }
+            rowStart += block.rows;
+        }
+        if(!file)
+        {
+            printError("Unable to read " + pathStr);
+        }
+
+        std::vector<std::string> names;
+        for(auto &field: fields)
+        {
+            names.push_back(std::string(field.name, strnlen(field.name, STATE_FILE_NAME_LENGTH)));
+        }
+        names.push_back("droppedSamples");
+
+        StructArray log = af.createStructArray({1, 1}, names);
+        for(size_t fieldIndex=0; fieldIndex<fields.size(); fieldIndex++)
+        {
+            log[0][names[fieldIndex]] = af.createArrayFromBuffer<double>({static_cast<size_t>(rows), fields[fieldIndex].width},
+                std::move(buffers[fieldIndex]));
+        }
+        log[0]["droppedSamples"] = af.createScalar<double>(static_cast<double>(header.droppedCount));
+        outputs[0] = log;
+    }
+
+    void printError(std::string err)
+    {
+        matlabPtr->feval(u"error", 0,
+                std::vector<matlab::data::Array>(
+                    { af.createScalar(err) }));
+    }
+
+};
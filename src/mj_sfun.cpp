@@ -4,6 +4,8 @@
 #include "simstruc.h"
 
 #include "mj.hpp"
+#include "threadpool.hpp"
+#include "tracer.hpp"
 #include <string>
 #include <stdio.h>
 #include <thread>
@@ -16,6 +18,7 @@
 #define PORT_STRING_LMT 1000
 #define ERROR_LMT 100
 #define PARAM_STRING_LIMIT 100
+#define OPTIONS_STRING_LIMIT 1000
 
 /* S-Function parameter indices */
 typedef enum {
@@ -30,6 +33,7 @@ typedef enum {
     CAMERA_SAMPLETIME_INDEX,
     BLOCK_SAMPLETIME_INDEX,
     ZOOM_LEVEL_INDEX,
+    OPTIONS_INDEX, // optional. See getOptionString
     PARAM_COUNT
 } paramIdx;
 
@@ -39,18 +43,21 @@ typedef enum {
     INPORT_COUNT
 } inportIndex;
 
-// output indices
+// output indices. The optional ports follow the fixed ones in this order. See optionalPortIndex
 typedef enum {
     SENSOR_PORT_INDEX = 0,
     RGB_PORT_INDEX,
     DEPTH_PORT_INDEX,
-    OUTPORT_COUNT
+    FIXED_OUTPORT_COUNT
 } outportIndex;
 
 typedef enum 
 {
     MI_IW_IDX=0,
     MG_IW_IDX,
+    PARALLEL_STEP_IW_IDX,
+    POINTCLOUD_PORT_IW_IDX, // -1 when the port is not there
+    DIAGNOSTICS_PORT_IW_IDX, // -1 when the port is not there
     IWORK_COUNT
 }iWorkIndex;
 
@@ -83,6 +90,11 @@ class _StaticData
     std::thread renderingThread;
     std::atomic<bool> renderingThreadStarted = false;
     std::atomic<bool> signalThreadExit = false;
+    eventSignal renderWakeup; // camera requests and exit wake up the rendering thread
+
+    // Shared by all blocks that opt in to parallel stepping
+    std::unique_ptr<workStealingPool> stepPool;
+    mutex stepPoolMutex;
 
     // Window management
     bool leftButton = false;
@@ -94,6 +106,7 @@ class _StaticData
     void deleter()
     {
         // clear the blocks memory after each simulation
+        stepPool.reset(); // joins the workers
         mg.clear();
         mi.clear();
         renderingInitErr = NO_ERR;
@@ -115,6 +128,12 @@ std::atomic<unsigned long> activeSimulinkBlocksCount{0};
     Make sure mi and mg vector are protected during the phase they can change (init)
 */
 
+static int miCount()
+{
+    // block indices are stored as int in IWork
+    return static_cast<int>(sd.mi.size());
+}
+
 // END OF STATIC/GLOBAL Variables---------------------------
 
 
@@ -230,6 +249,64 @@ int getIntParam(SimStruct *S, int index)
     return static_cast<int>(param);
 }
 
+std::string trimString(const std::string &str)
+{
+    size_t first = str.find_first_not_of(" \t");
+    if(first == std::string::npos) return "";
+    size_t last = str.find_last_not_of(" \t");
+    return str.substr(first, last-first+1);
+}
+
+// Advanced options are given as an optional trailing char parameter of "name=value" pairs,
+//  e.g. 'parallelStep=1, stepThreads=8'. Unknown names are ignored.
+// A char array is used instead of a struct since struct parameters are not available in generated code.
+bool getOptionString(SimStruct *S, const char *name, std::string &value)
+{
+    if(ssGetSFcnParamsCount(S) <= OPTIONS_INDEX) return false;
+
+    const mxArray *optionsMx = ssGetSFcnParam(S, OPTIONS_INDEX);
+    char options[OPTIONS_STRING_LIMIT];
+    if(mxGetString(optionsMx, options, OPTIONS_STRING_LIMIT-1) != 0) return false;
+
+    std::string optionsStr(options);
+    size_t start = 0;
+    while(start < optionsStr.size())
+    {
+        size_t end = optionsStr.find_first_of(",;", start);
+        if(end == std::string::npos) end = optionsStr.size();
+
+        std::string item = optionsStr.substr(start, end-start);
+        size_t separator = item.find('=');
+        if(separator != std::string::npos && trimString(item.substr(0, separator)) == name)
+        {
+            value = trimString(item.substr(separator+1));
+            return true;
+        }
+        start = end+1;
+    }
+    return false;
+}
+
+double getOptionDouble(SimStruct *S, const char *name, double defaultValue)
+{
+    std::string value;
+    if(!getOptionString(S, name, value) || value.empty()) return defaultValue;
+    return strtod(value.c_str(), NULL);
+}
+
+// OPTIONAL OUTPUT PORTS. Index of the port or -1 when its option is off
+static int pointCloudPortIndex(SimStruct *S)
+{
+    return (getOptionDouble(S, "pointCloud", 0) != 0) ? FIXED_OUTPORT_COUNT : -1;
+}
+
+static int diagnosticsPortIndex(SimStruct *S)
+{
+    if(getOptionDouble(S, "diagnosticsPort", 0) == 0) return -1;
+    return (pointCloudPortIndex(S) < 0) ? FIXED_OUTPORT_COUNT : FIXED_OUTPORT_COUNT+1;
+}
+
+// PARALLEL STEPPING --------------------------------------------------
 // MODEL INIT ---------------------------------------------------------
 static void mdlInitializeSizes(SimStruct *S)
 {
@@ -237,26 +314,26 @@ static void mdlInitializeSizes(SimStruct *S)
 
     //BASIC PARAMETERS --------------------------------------------------------------------------------
     // parameter sizes
-    ssSetNumSFcnParams(S, (int)PARAM_COUNT);
+    // The last (options) parameter is optional. So the parameter count is checked here instead of by Simulink
+    ssSetNumSFcnParams(S, -1);
 
-    if (ssGetNumSFcnParams(S) != ssGetSFcnParamsCount(S)) {
-        if (ssGetErrorStatus(S) != NULL) {
-            return;
-        }
-        return; /* Parameter mismatch will be reported by Simulink */
+    int paramCount = ssGetSFcnParamsCount(S);
+    if (paramCount != (int)OPTIONS_INDEX && paramCount != (int)PARAM_COUNT) {
+        ssSetErrorStatus(S, "Unexpected number of S-Function parameters");
+        return;
     }
     
     // sample times
     ssSetNumSampleTimes(S, 1);
     
-    /* specify the sim state compliance to be same as a built-in block */
-    ssSetOperatingPointCompliance(S, OPERATING_POINT_COMPLIANCE_UNKNOWN);
+    // Operating point is saved/restored by mdlGetOperatingPoint/mdlSetOperatingPoint. Also enables fast restart
+    ssSetOperatingPointCompliance(S, USE_CUSTOM_OPERATING_POINT);
 
     /* Set this S-function as runtime thread-safe for multicore execution */
     ssSetRuntimeThreadSafetyCompliance(S, RUNTIME_THREAD_SAFETY_COMPLIANCE_TRUE );
 
     // Set all parameter as non-tunable
-    for(int index = 0; index<PARAM_COUNT; index++)
+    for(int index = 0; index<paramCount; index++)
     {
         ssSetSFcnParamTunable(S, index,  SS_PRM_NOT_TUNABLE);
     }
@@ -269,11 +346,6 @@ static void mdlInitializeSizes(SimStruct *S)
 
     ssSupportsMultipleExecInstances(S, true); // support for-each subsystem
 
-    // Operating point compliance is required for enabling fast restart. 
-    // But no idea what it means or how to check for it.
-    // TODO - support fast restart
-    // ssSetOperatingPointCompliance(S, DISALLOW_OPERATING_POINT);
-
     if (!ssSetNumInputPorts(S, INPORT_COUNT)) return;
     ssSetInputPortWidth(S, CONTROL_PORT_INDEX, getIntParam(S, CONTROL_LENGTH_INDEX) + 1);
     // Last element is a dummy. In case we have a empty count, we will still show a dummy port in S function and handle the nuances in ML/SL layer
@@ -283,7 +355,10 @@ static void mdlInitializeSizes(SimStruct *S)
     ssSetInputPortDataType(S, CONTROL_PORT_INDEX, SS_DOUBLE);
 
     // sensor output
-    if (!ssSetNumOutputPorts(S, OUTPORT_COUNT)) return;
+    int pointCloudPort = pointCloudPortIndex(S);
+    int diagnosticsPort = diagnosticsPortIndex(S);
+    int outportCount = FIXED_OUTPORT_COUNT + (pointCloudPort >= 0) + (diagnosticsPort >= 0);
+    if (!ssSetNumOutputPorts(S, outportCount)) return;
 
     ssSetOutputPortWidth(S, SENSOR_PORT_INDEX, getIntParam(S, SENSOR_LENGTH_INDEX) + 1);
     // last index is a dummy. In case sensor count is 0, it will still let us keep sensor as dummy port.
@@ -294,6 +369,18 @@ static void mdlInitializeSizes(SimStruct *S)
     ssSetOutputPortWidth(S, DEPTH_PORT_INDEX, getIntParam(S, DEPTH_LENGTH_INDEX) + 1);
     ssSetOutputPortDataType(S, RGB_PORT_INDEX, SS_UINT8);
     ssSetOutputPortDataType(S, DEPTH_PORT_INDEX, SS_SINGLE);
+    if(pointCloudPort >= 0)
+    {
+        // xyz for every depth pixel. last index is a dummy like the other ports
+        ssSetOutputPortWidth(S, pointCloudPort, 3*getIntParam(S, DEPTH_LENGTH_INDEX) + 1);
+        ssSetOutputPortDataType(S, pointCloudPort, SS_SINGLE);
+    }
+    if(diagnosticsPort >= 0)
+    {
+        // count, mean, p50, p99, max (us) of every timed phase. See perfcounters.hpp
+        ssSetOutputPortWidth(S, diagnosticsPort, PERF_DIAGNOSTICS_LENGTH);
+        ssSetOutputPortDataType(S, diagnosticsPort, SS_DOUBLE);
+    }
 
     // INITIALIZE WORK VECTORS
     ssSetNumIWork(S, (int)IWORK_COUNT);
@@ -304,6 +391,10 @@ static void mdlInitializeSampleTimes(SimStruct *S)
     const mxArray *mexPtr = ssGetSFcnParam(S, BLOCK_SAMPLETIME_INDEX);
     double sampleTime = mxGetScalar(mexPtr);
 
+    // with sub stepping, the block runs once every substeps physics steps
+    double substeps = getOptionDouble(S, "substeps", 1);
+    if(substeps > 1) sampleTime *= static_cast<int>(substeps);
+
     ssSetSampleTime(S, 0, sampleTime);
     ssSetOffsetTime(S, 0, 0.0);
     ssSetModelReferenceSampleTimeDefaultInheritance(S);
@@ -330,6 +421,49 @@ static void mdlStart(SimStruct *S)
         // mi will not be reduced or reordered, so mutex can be unlocked.
     sd.miInitMutex.unlock(); 
     
+    {
+        // GL BACKEND FOR OFFSCREEN CAMERAS (egl/osmesa run without a display server)
+        std::string backendStr;
+        if(getOptionString(S, "glBackend", backendStr))
+        {
+            if(!parseGlBackend(backendStr, sd.mi[miIndex]->offscreenBackend))
+            {
+                ssSetLocalErrorStatus(S,"Unknown glBackend option. Expected glfw, egl or osmesa");
+                return;
+            }
+        }
+    }
+
+    // CAMERA ATLAS. all cameras of the model share one framebuffer and one readback
+    sd.mi[miIndex]->cameraAtlas = (getOptionDouble(S, "cameraAtlas", 0) != 0);
+    // ASYNCHRONOUS CAMERA READBACK through pixel buffer objects
+    sd.mi[miIndex]->cameraAsyncReadback = (getOptionDouble(S, "cameraAsyncReadback", 0) != 0);
+    // DEPTH POST PROCESSING in the rendering thread
+    std::string depthOutput;
+    sd.mi[miIndex]->cameraMetricDepth = (getOptionString(S, "depthOutput", depthOutput) && depthOutput == "metric");
+    ssSetIWorkValue(S, POINTCLOUD_PORT_IW_IDX, pointCloudPortIndex(S));
+    sd.mi[miIndex]->cameraPointCloud = (ssGetIWorkValue(S, POINTCLOUD_PORT_IW_IDX) >= 0);
+    // HOT PATH TIMING. the diagnostics port needs the counters
+    ssSetIWorkValue(S, DIAGNOSTICS_PORT_IW_IDX, diagnosticsPortIndex(S));
+    sd.mi[miIndex]->perf.enabled = (getOptionDouble(S, "perfCounters", 0) != 0 || ssGetIWorkValue(S, DIAGNOSTICS_PORT_IW_IDX) >= 0);
+    // CAMERA OUTPUT LAYOUT
+    std::string cameraLayout;
+    sd.mi[miIndex]->cameraMatlabLayout = (getOptionString(S, "cameraLayout", cameraLayout) && cameraLayout == "matlab");
+    // SKIP CAMERA RENDERS of an unchanged scene
+    sd.mi[miIndex]->cameraSkipUnchanged = (getOptionDouble(S, "cameraSkipUnchanged", 0) != 0);
+    sd.mi[miIndex]->cameraChangeTolerance = getOptionDouble(S, "cameraChangeTolerance", 0);
+    // CAMERA FRAME RECORDING (file is opened in the rendering thread once the camera sizes are known)
+    getOptionString(S, "recordFrames", sd.mi[miIndex]->frameRecordPath);
+    {
+        // CHROME TRACE of all blocks. the first block with the option starts it, the last mdlTerminate writes it
+        std::string tracePath;
+        if(getOptionString(S, "traceFile", tracePath) && !tracePath.empty())
+        {
+            traceRecorder::global().start(tracePath);
+            traceRecorder::global().setThreadName("Simulink");
+        }
+    }
+
     // MODEL INIT
     if(sd.mi[miIndex]->initMdl(file, true, false) != 0)
     {
@@ -344,6 +478,20 @@ static void mdlStart(SimStruct *S)
        return;
     }
 
+    {
+        // SENSOR PORT WIDTH. the port is sized by a block parameter, the loaded model decides the sensor scalar count
+        int_T ny = ssGetOutputPortWidth(S, SENSOR_PORT_INDEX);
+        unsigned sensorScalars = sd.mi[miIndex]->si.scalarCount;
+        if(static_cast<int_T>(sensorScalars) + 1 > ny)
+        {
+            static std::string err;
+            err = "Sensor output port holds " + std::to_string(ny - 1) + " values but the model has "
+                + std::to_string(sensorScalars) + " sensor values. Was the XML changed after the block buses were created?";
+            ssSetLocalErrorStatus(S, err.c_str()); // do not pass char array that may go out of its lifetime
+            return;
+        }
+    }
+
     {
         // INIT CAMERA RENDER INTERVAL
         const mxArray *paramMx = ssGetSFcnParam(S, CAMERA_SAMPLETIME_INDEX);
@@ -351,6 +499,70 @@ static void mdlStart(SimStruct *S)
         sd.mi[miIndex]->cameraRenderInterval = cameraSampleTime;
     }
 
+    {
+        // STATE LOGGING
+        std::string logPath;
+        if(getOptionString(S, "logState", logPath) && !logPath.empty())
+        {
+            std::string logFields = "qpos qvel ctrl sensordata";
+            getOptionString(S, "logFields", logFields);
+            int logStatus = sd.mi[miIndex]->startStateLogging(logPath, logFields);
+            if(logStatus == -1)
+            {
+                ssSetLocalErrorStatus(S, "Unknown field in logFields option");
+                return;
+            }
+            if(logStatus != 0)
+            {
+                ssSetLocalErrorStatus(S, "Unable to create the logState file");
+                return;
+            }
+        }
+    }
+
+    {
+        // SUB STEPPING AND CONTROL INTERPOLATION
+        double substeps = getOptionDouble(S, "substeps", 1);
+        sd.mi[miIndex]->substeps = (substeps > 1) ? static_cast<unsigned>(substeps) : 1;
+
+        std::string interpStr;
+        if(getOptionString(S, "controlInterpolation", interpStr) && interpStr == "foh")
+        {
+            sd.mi[miIndex]->interp = CTRL_FOH;
+        }
+    }
+
+    {
+        // PIPELINED CAMERA RENDERING (opt-in). Camera outputs lag by one camera sample time
+        if(getOptionDouble(S, "cameraPipeline", 0) != 0)
+        {
+            if(sd.mi[miIndex]->enableCameraPipeline() != 0)
+            {
+                ssSetLocalErrorStatus(S,"Unable to allocate pipelined camera data in mdlStart");
+                return;
+            }
+        }
+    }
+
+    {
+        // PARALLEL STEPPING (opt-in). mdlUpdate only queues the step and the next mdlOutputs joins on it
+        int parallelStep = static_cast<int>(getOptionDouble(S, "parallelStep", 0));
+        if(parallelStep)
+        {
+            std::lock_guard<std::mutex> poolLock(sd.stepPoolMutex);
+            if(!sd.stepPool)
+            {
+                // the first block decides the size of the shared pool
+                double threadCount = getOptionDouble(S, "stepThreads", std::thread::hardware_concurrency());
+                sd.stepPool = std::make_unique<workStealingPool>(static_cast<unsigned>(threadCount));
+            }
+            // at most one step per block is in flight. every block that steps in the pool grows the queues here
+            //  so that submit in mdlUpdate never allocates
+            sd.stepPool->reserve(static_cast<unsigned>(miCount()));
+        }
+        ssSetIWorkValue(S, PARALLEL_STEP_IW_IDX, parallelStep ? 1 : 0);
+    }
+
     ssSetIWorkValue(S, MI_IW_IDX, miIndex);
 
     // VISUALIZATION SETUP
@@ -397,6 +609,12 @@ static void mdlStart(SimStruct *S)
                 sd.mg[mgIndex]->renderInterval = renderInterval;
             }
 
+            {
+                // SETUP INSTANCE BUDGET (Global windows. read from the block that creates the window)
+                double instanceBudget = getOptionDouble(S, "windowInstanceBudget", 0);
+                sd.mg[mgIndex]->instanceBudget = (instanceBudget > 0) ? static_cast<unsigned>(instanceBudget) : 0;
+            }
+
             if(guiStatus != NO_ERR)
             {
                 static std::string err = "Unable to initialize GUI in mdlStart. Error code=" + std::to_string(guiStatus);
@@ -420,6 +638,50 @@ static void mdlStart(SimStruct *S)
 
 }
 
+// Called at the start of every run. With fast restart, mdlStart and mdlTerminate run only once,
+//  so the model, GL contexts and threads stay alive and only the simulation state is reset here.
+#define MDL_INITIALIZE_CONDITIONS
+static void mdlInitializeConditions(SimStruct *S)
+{
+    int miIndex = ssGetIWorkValue(S, MI_IW_IDX);
+    if(miIndex < 0 || miIndex >= miCount()) return;
+
+    auto &miTemp = sd.mi[miIndex];
+    miTemp->quiesce();
+    miTemp->resetState();
+    miTemp->isCameraDataNew = false;
+    miTemp->perf.reset();
+}
+
+#if defined(MATLAB_MEX_FILE)
+#define MDL_OPERATING_POINT
+static mxArray *mdlGetOperatingPoint(SimStruct *S)
+{
+    int miIndex = ssGetIWorkValue(S, MI_IW_IDX);
+    auto &miTemp = sd.mi[miIndex];
+    miTemp->quiesce();
+
+    std::vector<double> point = miTemp->getOperatingPoint();
+    mxArray *pointMx = mxCreateDoubleMatrix(point.size(), 1, mxREAL);
+    memcpy(mxGetPr(pointMx), point.data(), point.size()*sizeof(double));
+    return pointMx;
+}
+
+static void mdlSetOperatingPoint(SimStruct *S, const mxArray *pointMx)
+{
+    int miIndex = ssGetIWorkValue(S, MI_IW_IDX);
+    auto &miTemp = sd.mi[miIndex];
+    miTemp->quiesce();
+
+    if(!mxIsDouble(pointMx) || miTemp->setOperatingPoint(mxGetPr(pointMx), mxGetNumberOfElements(pointMx)) != 0)
+    {
+        ssSetErrorStatus(S, "Operating point does not match the MuJoCo model of this block");
+        return;
+    }
+    miTemp->isCameraDataNew = false;
+}
+#endif
+
 #define MDL_UPDATE
 static void mdlUpdate(SimStruct *S, int_T tid)
 {
@@ -432,18 +694,24 @@ static void mdlUpdate(SimStruct *S, int_T tid)
     // progress simulation by 1 time step in discrete time
     int miIndex = ssGetIWorkValue(S, MI_IW_IDX);  
 
-    vector<double> uVec;
     int_T nInputs = ssGetInputPortWidth(S, CONTROL_PORT_INDEX) - 1; // last index is a dummy
     InputRealPtrsType uPtrs = ssGetInputPortRealSignalPtrs(S, CONTROL_PORT_INDEX);
-    for (int i = 0; i < nInputs; i++) 
-    {
-        uVec.push_back((double) *uPtrs[i]);
-    }
 
     auto &miTemp = sd.mi[miIndex]; 
+    traceScope trace("mdlUpdate", miIndex);
 
     // Step the simulation by one discrete time step. Outputs (sensors and camera) get reflected in the next step
-    miTemp->step(uVec);
+    // Controls are written directly from the port pointers into mjData (no per step allocation)
+    if(ssGetIWorkValue(S, PARALLEL_STEP_IW_IDX))
+    {
+        // inputs are only valid during this call. the pool advances the physics, the next mdlOutputs joins
+        miTemp->stepInPool(*sd.stepPool, uPtrs, static_cast<unsigned>(nInputs));
+    }
+    else
+    {
+        traceScope stepTrace("step", miIndex);
+        miTemp->step(uPtrs, static_cast<unsigned>(nInputs));
+    }
 }
 
 void renderingThreadFcn()
@@ -459,39 +727,22 @@ void renderingThreadFcn()
 
     // I am not sure about the thread MATLAB uses to execute this s function
 
-    // MODEL CAMERA INIT
-    for(int miIndex=0; miIndex<sd.mi.size(); miIndex++)
-    {
-        auto &miTemp = sd.mi[miIndex];
-        std::lock_guard<std::mutex> mutLock(miTemp->camiMutex);
-        
-        cameraInterface &camiTemp = miTemp->cami;
-        camiTemp.count = miTemp->offscreenCam.size();
-        // names are not needed here in s function.
+    traceRecorder &tracer = traceRecorder::global();
+    tracer.setThreadName("rendering");
+    tracer.begin("rendering init");
 
-        unsigned long rgbAddr = 0;
-        unsigned long depthAddr = 0;
-        for(int camIndex = 0; camIndex<camiTemp.count; camIndex++)
+    // MODEL CAMERA INIT and CAMERA FRAME RECORDING
+    for(int miIndex=0; miIndex<miCount(); miIndex++)
+    {
+        auto guiStatus = sd.mi[miIndex]->initRenderingInThread();
+        if(guiStatus != NO_ERR)
         {
-            offscreenSize offSize;
-            auto guiStatus = sd.mi[miIndex]->offscreenCam[camIndex]->initInThread(&offSize);
-            if(guiStatus != NO_ERR)
-            {
-                std::lock_guard<std::mutex> renderingInitErrLock(sd.renderingInitErrMutex);
-                sd.renderingInitErr = guiStatus;
-                // STOP SIMULATION HERE ITSELF!
-                // lets not stop simulation due to a rendering issue. 
-                // throw a warning at the end of simulation
-                // TODO - Donot know how to stop simulation here. (that works in both codegen and normal mode)
-            }
-            camiTemp.size.push_back(offSize);
-            camiTemp.rgbAddr.push_back(rgbAddr);
-            camiTemp.depthAddr.push_back(depthAddr);
-            rgbAddr += 3*offSize.height*offSize.width; // location of next rgb or length of rgb stored so far
-            depthAddr += offSize.height*offSize.width;
+            std::lock_guard<std::mutex> renderingInitErrLock(sd.renderingInitErrMutex);
+            sd.renderingInitErr = guiStatus;
+            // lets not stop simulation due to a rendering issue. 
+            // throw a warning at the end of simulation
+            // TODO - Donot know how to stop simulation here. (that works in both codegen and normal mode)
         }
-        camiTemp.rgbLength = rgbAddr;
-        camiTemp.depthLength = depthAddr;
     }
 
     // INIT GUI windows
@@ -509,48 +760,33 @@ void renderingThreadFcn()
         glfwSetMouseButtonCallback(sd.mg[index]->window, mouseButtonCallback);
         glfwSetScrollCallback(sd.mg[index]->window, scrollCallback);
     }
-    
+    tracer.end("rendering init");
+
 
     // Visualization window and offscreen buffer rendering loop
     while(1)
     {
         // Visualization window(s)
-        for(int index=0; index<sd.mg.size(); index++)
-        {
-            auto duration = std::chrono::steady_clock::now() - sd.mg[index]->lastRenderClockTime;
-            if (duration>sd.mg[index]->renderInterval)
-            {
-                if(sd.mg[index]->loopInThread() == 0) 
-                {
-                    sd.mg[index]->lastRenderClockTime = std::chrono::steady_clock::now();
-                }
-            }
-        }
+        auto nextWindowDeadline = renderWindowsInThread(sd.mg);
 
         // Offscreen buffers
-        for(int miIndex=0; miIndex<sd.mi.size(); miIndex++)
-        {   
-            auto &miTemp = sd.mi[miIndex];
-
-            if(miTemp->shouldCameraRenderNow == true)
-            {
-                // if rendering is already done and not consumed, dont do again
-                for(int camIndex = 0; camIndex<miTemp->offscreenCam.size(); camIndex++)
-                {
-                    auto status = miTemp->offscreenCam[camIndex]->loopInThread();
-                    if(status == 0)
-                    {
-                        miTemp->lastRenderTime = miTemp->get_d()->time;
-                        miTemp->isCameraDataNew = true; // Used to indicate that a new data is available for copying into blk output
-                    }
-                }
-                miTemp->shouldCameraRenderNow = false;
-                miTemp->cameraSync.release();
-                
-            }
+        for(int miIndex=0; miIndex<miCount(); miIndex++)
+        {
+            sd.mi[miIndex]->serveCameraRequestInThread(miIndex);
         }
-        // If there is nothing to render, donot keep spinning while loop
         if(sd.signalThreadExit == true) break;
+
+        // If there is nothing to render, donot keep spinning while loop.
+        // Sleep till the next window frame is due or a camera render/exit is signalled
+        traceScope idleTrace("idle");
+        if(nextWindowDeadline == std::chrono::steady_clock::time_point::max())
+        {
+            sd.renderWakeup.wait();
+        }
+        else
+        {
+            sd.renderWakeup.waitUntil(nextWindowDeadline);
+        }
     }
 
     // Release visualization resources
@@ -560,12 +796,9 @@ void renderingThreadFcn()
     }
 
     // Release offscreen buffers
-    for(int miIndex=0; miIndex<sd.mi.size(); miIndex++)
+    for(int miIndex=0; miIndex<miCount(); miIndex++)
     {
-        for(int camIndex = 0; camIndex<sd.mi[miIndex]->offscreenCam.size(); camIndex++)
-        {
-            sd.mi[miIndex]->offscreenCam[camIndex]->releaseInThread();
-        }
+        sd.mi[miIndex]->releaseRenderingInThread();
     }
     
     glfwTerminate();
@@ -575,56 +808,81 @@ static void mdlOutputs(SimStruct *S, int_T tid)
 {
     int miIndex = ssGetIWorkValue(S, MI_IW_IDX);
     auto &miTemp = sd.mi[miIndex]; 
+    traceScope trace("mdlOutputs", miIndex);
+
+    // In parallel stepping mode, the step queued in the last mdlUpdate has to finish before reading the data
+    miTemp->joinPendingStep(miIndex);
     
     // Copy sensors to output
     real_T *y = ssGetOutputPortRealSignal(S, SENSOR_PORT_INDEX);
-    int_T ny = ssGetOutputPortWidth(S, SENSOR_PORT_INDEX);
-    int_T index = 0;
 
+    // Single lock and bulk copy of sensordata straight into the output buffer. mdlStart checked that the port fits
     auto nSensors = miTemp->si.count;
-    for(int_T i=0; i<nSensors; i++)
-    {
-        vector<double> yVec = miTemp->getSensor(i);
-        for(auto elem: yVec)
-        {
-            y[index] = elem;
-            index++;
-            // TODO add a check in case index exceeds the allowed limit
-        }
-    }
+    size_t index = miTemp->getSensors(y);
     y[index] = static_cast<double>(nSensors); // last element is a dummy to handle empty sensor case
 
-    // Render camera based on the current states. mdlupdate will be called after mdloutputs and update moves the time tk to tk+1
-    if(miTemp->offscreenCam.size() != 0)
-    {
-        double elapsedTimeSinceRender = miTemp->get_d()->time - miTemp->lastRenderTime;
-        if( elapsedTimeSinceRender > (miTemp->cameraRenderInterval-0.00001) )
-        {
-            // maintain camera and physics in sync at required camera sample time
-            miTemp->shouldCameraRenderNow = true;
-            miTemp->cameraSync.acquire(); // blocking till offscreen buffer is rendered
+    // Render camera based on the current states (at the camera sample time). Pipelined cameras output the previous request
+    cameraSampleStatus cameraStatus = miTemp->requestCameraSample(sd.renderWakeup, miIndex);
 
-            // ssPrintf("sim time=%lf & render time=%lf\n", miTemp->get_d()->time, miTemp->lastRenderTime);
-        }
+    // Copy camera to output
+    if(cameraStatus == CAMERA_COLLECTED)
+    {
+        uint8_T *rgbOut = (uint8_T *) ssGetOutputPortSignal(S, RGB_PORT_INDEX);
+        real32_T *depthOut = (real32_T *) ssGetOutputPortSignal(S, DEPTH_PORT_INDEX);
+        int pointCloudPort = ssGetIWorkValue(S, POINTCLOUD_PORT_IW_IDX);
+        float *pointsOut = pointCloudPort >= 0 ? (float *) ssGetOutputPortSignal(S, pointCloudPort) : nullptr;
+        miTemp->copyCameraFrame((uint8_t *) rgbOut, (float *) depthOut, pointsOut, miIndex);
     }
 
-    // Copy camera to output
-    uint8_T *rgbOut = (uint8_T *) ssGetOutputPortSignal(S, RGB_PORT_INDEX);
-    real32_T *depthOut = (real32_T *) ssGetOutputPortSignal(S, DEPTH_PORT_INDEX);
-    if(miTemp->isCameraDataNew)
+    int diagnosticsPort = ssGetIWorkValue(S, DIAGNOSTICS_PORT_IW_IDX);
+    if(diagnosticsPort >= 0)
     {
-        //avoid unnecessary memcpy. copy only when there is new data. Rest of the time steps, old data will be output
-        miTemp->getCameraRGB((uint8_t *) rgbOut);
-        miTemp->getCameraDepth((float *) depthOut);
-        miTemp->isCameraDataNew = false;
+        miTemp->perf.fill(ssGetOutputPortRealSignal(S, diagnosticsPort));
     }
 }
 
 static void mdlTerminate(SimStruct *S)
 {
+    int miIndex = ssGetIWorkValue(S, MI_IW_IDX);
+
+    // the pipelined render requests of every block have to be consumed before the rendering thread is stopped.
+    // the rendering thread may have passed another block's request when it sees the exit signal.
+    // that block's own mdlTerminate would otherwise wait for the request forever
+    for(auto &mi: sd.mi)
+    {
+        mi->quiesce();
+    }
+
     sd.signalThreadExit = true;
+    sd.renderWakeup.notify();
     if(sd.renderingThread.joinable()) sd.renderingThread.join();
 
+    if(miIndex >= 0 && miIndex < miCount())
+    {
+        // timing summary. the rendering thread has stopped, so the render phase is complete
+        if(sd.mi[miIndex]->perf.enabled)
+        {
+            std::string report = sd.mi[miIndex]->perf.summary();
+            ssPrintf("MuJoCo block %s timing:\n%s", ssGetPath(S), report.c_str());
+        }
+
+        if(sd.mi[miIndex]->cameraSkipUnchanged)
+        {
+            ssPrintf("MuJoCo block %s skipped %llu unchanged camera renders\n", ssGetPath(S),
+                static_cast<unsigned long long>(sd.mi[miIndex]->cameraSkipCount.load()));
+        }
+
+        // flush the recorded frames and state log (if any) to disk
+        sd.mi[miIndex]->frameLog.reset();
+        auto &stateLog = sd.mi[miIndex]->stateLog;
+        if(stateLog && stateLog->droppedSamples() > 0)
+        {
+            std::string warn = "State logger dropped " + std::to_string(stateLog->droppedSamples()) + " samples (disk too slow)";
+            ssWarning(S, warn.c_str());
+        }
+        stateLog.reset();
+    }
+
     std::lock_guard<std::mutex> lockSD (sdMutex);
     activeSimulinkBlocksCount--;
     if(activeSimulinkBlocksCount == 0)
@@ -637,6 +895,19 @@ static void mdlTerminate(SimStruct *S)
             ssWarning(S, err.c_str());
         }
         sd.renderingInitErrMutex.unlock();
+
+        // all threads have stopped or are idle. write the trace (if any)
+        uint64_t droppedEvents = 0;
+        if(!traceRecorder::global().stop(droppedEvents))
+        {
+            ssWarning(S, "Unable to write the traceFile");
+        }
+        else if(droppedEvents > 0)
+        {
+            static std::string warn;
+            warn = "Trace buffers were full. " + std::to_string(droppedEvents) + " events were dropped";
+            ssWarning(S, warn.c_str());
+        }
         
         sd.deleter();
     }
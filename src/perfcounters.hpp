@@ -0,0 +1,167 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+// Hot path phases of a block
+typedef enum
+{
+    PERF_STEP = 0,     // mj_step of all substeps
+    PERF_DMUTEX_WAIT,  // waiting for dMutex before stepping
+    PERF_CAMERA_WAIT,  // mdlOutputs blocked in cameraSync.acquire()
+    PERF_CAMERA_COPY,  // copy of rgb, depth and point cloud into the output ports
+    PERF_RENDER,       // offscreen render and readback of all cameras in the rendering thread
+    PERF_PHASE_COUNT
+} perfPhase;
+
+// count, mean, p50, p99 and max (microseconds) of every phase, in perfPhase order
+#define PERF_STAT_COUNT 5
+#define PERF_DIAGNOSTICS_LENGTH (PERF_PHASE_COUNT*PERF_STAT_COUNT)
+
+class latencyHistogram
+{
+    // Log2 buckets of nanoseconds. One thread records at a time.
+    // Other threads may read while it records (relaxed atomics). Such reads are approximate, never torn.
+
+    public:
+    static constexpr unsigned BUCKET_COUNT = 40; // the last bucket holds everything above 2^39 ns (about 9 minutes)
+
+    void record(uint64_t ns)
+    {
+        unsigned bucket = 0;
+        for(uint64_t value = ns; value > 1 && bucket < BUCKET_COUNT-1; value >>= 1) bucket++;
+
+        increment(buckets[bucket], 1);
+        increment(count, 1);
+        increment(total, ns);
+        if(ns > max.load(std::memory_order_relaxed)) max.store(ns, std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for(auto &bucket: buckets) bucket.store(0, std::memory_order_relaxed);
+        count.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t samples() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    double meanMicroseconds() const
+    {
+        uint64_t n = samples();
+        return n ? total.load(std::memory_order_relaxed)/(1000.0*n) : 0;
+    }
+
+    double maxMicroseconds() const
+    {
+        return max.load(std::memory_order_relaxed)/1000.0;
+    }
+
+    // Estimated from the buckets (linear within the bucket), never above the max
+    double percentileMicroseconds(double p) const
+    {
+        uint64_t n = samples();
+        if(n == 0) return 0;
+        double rank = p/100.0*n;
+        uint64_t below = 0;
+        for(unsigned bucket=0; bucket<BUCKET_COUNT; bucket++)
+        {
+            uint64_t inBucket = buckets[bucket].load(std::memory_order_relaxed);
+            if(inBucket > 0 && below + inBucket >= rank)
+            {
+                double low = (bucket == 0) ? 0 : static_cast<double>(uint64_t(1) << bucket);
+                double high = static_cast<double>(uint64_t(1) << (bucket+1));
+                double ns = low + (high - low)*(rank - below)/inBucket;
+                return std::min(ns/1000.0, maxMicroseconds());
+            }
+            below += inBucket;
+        }
+        return maxMicroseconds();
+    }
+
+    private:
+    static void increment(std::atomic<uint64_t> &counter, uint64_t value)
+    {
+        // single writer. a plain load/store pair instead of a locked read modify write
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[BUCKET_COUNT] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total{0}; // ns
+    std::atomic<uint64_t> max{0}; // ns
+};
+
+class perfCounters
+{
+    // Per block latency histograms of the hot path phases. Recording costs two clock reads per phase.
+    // The histograms are left untouched while the counters are disabled.
+
+    public:
+    typedef std::chrono::steady_clock clock;
+
+    bool enabled = false; // set before the simulation starts
+
+    void record(perfPhase phase, clock::duration elapsed)
+    {
+        if(!enabled) return;
+        phases[phase].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    // Start of a phase. The clock is read only while the counters are enabled
+    clock::time_point now() const
+    {
+        return enabled ? clock::now() : clock::time_point();
+    }
+
+    void recordSince(perfPhase phase, clock::time_point start)
+    {
+        if(enabled) record(phase, clock::now() - start);
+    }
+
+    void reset()
+    {
+        for(auto &phase: phases) phase.reset();
+    }
+
+    // PERF_DIAGNOSTICS_LENGTH values
+    void fill(double *out) const
+    {
+        for(const auto &phase: phases)
+        {
+            *out++ = static_cast<double>(phase.samples());
+            *out++ = phase.meanMicroseconds();
+            *out++ = phase.percentileMicroseconds(50);
+            *out++ = phase.percentileMicroseconds(99);
+            *out++ = phase.maxMicroseconds();
+        }
+    }
+
+    std::string summary() const
+    {
+        static const char *names[PERF_PHASE_COUNT] = {"step", "dMutex wait", "camera wait", "camera copy", "render"};
+        char line[160];
+        snprintf(line, sizeof(line), "  %-12s %9s %12s %11s %11s %11s\n", "phase", "count", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+        std::string text = line;
+        for(unsigned index=0; index<PERF_PHASE_COUNT; index++)
+        {
+            const auto &phase = phases[index];
+            snprintf(line, sizeof(line), "  %-12s %9llu %12.1f %11.1f %11.1f %11.1f\n", names[index],
+                static_cast<unsigned long long>(phase.samples()), phase.meanMicroseconds(),
+                phase.percentileMicroseconds(50), phase.percentileMicroseconds(99), phase.maxMicroseconds());
+            text += line;
+        }
+        return text;
+    }
+
+    private:
+    latencyHistogram phases[PERF_PHASE_COUNT];
+};
@@ -1,9 +1,122 @@
 // Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 class binarySemp
 {
+    // Binary semaphore for short handoffs between two threads (camera request/render, deferred step).
+    // acquire spins for up to SPIN_TIME first, so a release that comes within microseconds costs no kernel call.
+    // After that the thread parks (futex on Linux, condition variable elsewhere). release only calls into
+    //  the kernel when a thread is parked.
+    // state: 0 - taken, 1 - available, 2 - taken and a thread may be parked
+
+    public:
+
+    bool check_availability()
+    {
+        return state.load(std::memory_order_acquire) == 1;
+    }
+
+    void acquire() // blocking call
+    {
+        // on a single core, spinning only delays the thread that is about to release
+        static const bool shouldSpin = std::thread::hardware_concurrency() > 1;
+        auto spinEnd = std::chrono::steady_clock::now() + SPIN_TIME;
+        while(shouldSpin)
+        {
+            for(unsigned index=0; index<SPIN_CHECK_INTERVAL; index++)
+            {
+                int expected = 1;
+                if(state.load(std::memory_order_relaxed) == 1 &&
+                   state.compare_exchange_weak(expected, 0, std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return;
+                }
+                cpuRelax();
+            }
+            if(std::chrono::steady_clock::now() >= spinEnd) break;
+        }
+
+        while(1)
+        {
+            // take the token as 2, as other threads may still be parked. The next release then wakes one of them
+            int expected = 1;
+            if(state.compare_exchange_strong(expected, 2, std::memory_order_acquire, std::memory_order_relaxed)) return;
+            if(expected == 0 && !state.compare_exchange_strong(expected, 2, std::memory_order_relaxed)) continue;
+            park();
+        }
+    }
+
+    void release()
+    {
+        if(state.exchange(1, std::memory_order_release) == 2) wake();
+    }
+
+    private:
+    static constexpr std::chrono::microseconds SPIN_TIME{20};
+    static constexpr unsigned SPIN_CHECK_INTERVAL = 64; // pauses between clock reads
+
+    static void cpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        __asm__ __volatile__("yield");
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+#if defined(__linux__)
+    // sleeps while state is 2
+    void park()
+    {
+        syscall(SYS_futex, reinterpret_cast<int *>(&state), FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+    }
+
+    void wake()
+    {
+        syscall(SYS_futex, reinterpret_cast<int *>(&state), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+#else
+    void park()
+    {
+        std::unique_lock<std::mutex> locker(mut);
+        cv.wait(locker, [this](){ return state.load(std::memory_order_relaxed) != 2;});
+    }
+
+    void wake()
+    {
+        // the lock orders this notification after the state check of a thread that is about to park
+        std::unique_lock<std::mutex> locker(mut);
+        locker.unlock();
+        cv.notify_one();
+    }
+
+    std::mutex mut;
+    std::condition_variable cv;
+#endif
+
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex needs a plain int");
+    std::atomic<int> state{0};
+};
+
+class condvarBinarySemp
+{
+    // Mutex and condition variable binary semaphore. Every handoff goes through the kernel.
+    // Kept as the reference for the spin then park binarySemp (see tools/bench/semp_bench.cpp)
     public:
 
     bool check_availability()
@@ -38,4 +151,40 @@ class binarySemp
     std::mutex mut;
     std::condition_variable cv;
     bool state = false; // 0 means it is blocked by someone
-};
\ No newline at end of file
+};
+
+class eventSignal
+{
+    // Wakes up a thread waiting for work. A notification is latched until consumed by a wait,
+    //  so notifying before the other thread starts waiting is not lost.
+    public:
+
+    void notify()
+    {
+        std::unique_lock<std::mutex> locker(mut);
+        state = true;
+        locker.unlock();
+        cv.notify_one();
+    }
+
+    void wait() // blocking call
+    {
+        std::unique_lock<std::mutex> locker(mut);
+        cv.wait(locker, [this](){ return state == true;});
+        state = false;
+    }
+
+    template <typename clockType, typename durationType>
+    void waitUntil(const std::chrono::time_point<clockType, durationType> &deadline)
+    {
+        // returns at the deadline or on notification, whichever comes first
+        std::unique_lock<std::mutex> locker(mut);
+        cv.wait_until(locker, deadline, [this](){ return state == true;});
+        state = false;
+    }
+
+    private:
+    std::mutex mut;
+    std::condition_variable cv;
+    bool state = false;
+};
@@ -0,0 +1,63 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+template <typename T>
+class spscRing
+{
+    // Lock free ring of fixed size records between a single producer and a single consumer.
+    // Head and tail are free running counters on separate cache lines. The capacity is a power of two.
+    // A full ring is reported to the producer instead of waiting, so the producer never blocks.
+
+    public:
+
+    void init(size_t recordLength, size_t minimumCapacity)
+    {
+        capacity = 1;
+        while(capacity < minimumCapacity) capacity <<= 1;
+        length = recordLength;
+        data.assign(capacity*length, T());
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side. NULL when the ring is full
+    T *writeSlot()
+    {
+        size_t position = head.load(std::memory_order_relaxed);
+        if(position - tail.load(std::memory_order_acquire) == capacity) return NULL;
+        return &data[(position & (capacity-1))*length];
+    }
+
+    void commit()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side. NULL when the ring is empty
+    const T *readSlot()
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        if(head.load(std::memory_order_acquire) == position) return NULL;
+        return &data[(position & (capacity-1))*length];
+    }
+
+    void release()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t recordLength()
+    {
+        return length;
+    }
+
+    private:
+    std::vector<T> data;
+    size_t capacity = 0;
+    size_t length = 0;
+    alignas(64) std::atomic<size_t> head{0}; // written by the producer
+    alignas(64) std::atomic<size_t> tail{0}; // written by the consumer
+};
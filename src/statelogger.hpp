@@ -0,0 +1,203 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include "spscring.hpp"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+// STATE LOG FILE
+// stateFileHeader, fieldCount x stateFileField, then blocks of up to blockRows samples.
+// Each block is a stateBlockHeader followed by the block's columns: for every field and every element of the field,
+//  rows consecutive doubles. A reader can therefore copy every column straight into a (samples x width) MATLAB array.
+// The first field is always the simulation time. Native byte order.
+
+#define STATE_FILE_MAGIC "MJSTATES"
+#define STATE_FILE_VERSION 1
+#define STATE_FILE_NAME_LENGTH 32
+
+struct stateFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t fieldCount;
+    uint32_t blockRows;
+    uint32_t reserved;
+    uint64_t rowCount; // written on close
+    uint64_t droppedCount; // samples lost because the ring was full. written on close
+};
+
+struct stateFileField
+{
+    char name[STATE_FILE_NAME_LENGTH];
+    uint32_t width;
+    uint32_t reserved;
+};
+
+struct stateBlockHeader
+{
+    uint32_t rows;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(stateFileHeader) == 40, "state file header must be packed");
+static_assert(sizeof(stateFileField) == 40, "state file field must be packed");
+static_assert(sizeof(stateBlockHeader) == 8, "state block header must be packed");
+
+struct stateLogField
+{
+    std::string name;
+    const double *source; // copied at every record. must stay valid while logging
+    uint32_t width;
+};
+
+class stateLogger
+{
+    // The producer (physics thread) copies the fields into a lock free ring at every record() call.
+    // A background thread drains the ring, transposes the samples into column blocks and writes them.
+    // If the writer falls behind and the ring is full, samples are dropped and counted. Physics is never blocked.
+
+    public:
+
+    ~stateLogger()
+    {
+        close();
+    }
+
+    bool open(const std::string &path, const std::vector<stateLogField> &logFields)
+    {
+        file = fopen(path.c_str(), "wb");
+        if(!file) return false;
+        setvbuf(file, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+
+        fields = logFields;
+        size_t recordLength = 1; // time
+        for(auto &field: fields) recordLength += field.width;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, STATE_FILE_MAGIC, sizeof(header.magic));
+        header.version = STATE_FILE_VERSION;
+        header.fieldCount = static_cast<uint32_t>(fields.size() + 1);
+        header.blockRows = BLOCK_ROWS;
+        fwrite(&header, sizeof(header), 1, file);
+
+        writeField("time", 1);
+        for(auto &field: fields) writeField(field.name, field.width);
+
+        // ring of about RING_BYTES, at least a few blocks worth of samples
+        size_t capacity = RING_BYTES/(sizeof(double)*recordLength);
+        if(capacity < 4*BLOCK_ROWS) capacity = 4*BLOCK_ROWS;
+        ring.init(recordLength, capacity);
+        block.resize(recordLength*BLOCK_ROWS);
+        blockRowCount = 0;
+
+        stop = false;
+        writer = std::thread(&stateLogger::writerLoop, this);
+        return true;
+    }
+
+    // Producer side. Allocation and lock free
+    void record(double time)
+    {
+        double *slot = ring.writeSlot();
+        if(!slot)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        *slot++ = time;
+        for(auto &field: fields)
+        {
+            memcpy(slot, field.source, field.width*sizeof(double));
+            slot += field.width;
+        }
+        ring.commit();
+    }
+
+    void close()
+    {
+        if(!file) return;
+        stop = true;
+        if(writer.joinable()) writer.join();
+
+        header.rowCount = rows;
+        header.droppedCount = dropped.load();
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+        file = NULL;
+    }
+
+    uint64_t droppedSamples()
+    {
+        return dropped.load();
+    }
+
+    private:
+    static constexpr uint32_t BLOCK_ROWS = 1024;
+    static constexpr size_t RING_BYTES = 1 << 24;
+    static constexpr size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+    void writeField(const std::string &name, uint32_t width)
+    {
+        stateFileField field;
+        memset(&field, 0, sizeof(field));
+        strncpy(field.name, name.c_str(), STATE_FILE_NAME_LENGTH-1);
+        field.width = width;
+        fwrite(&field, sizeof(field), 1, file);
+    }
+
+    void writerLoop()
+    {
+        size_t recordLength = ring.recordLength();
+        while(1)
+        {
+            bool isStopping = stop.load();
+
+            // drain the ring into the column block
+            while(const double *sample = ring.readSlot())
+            {
+                for(size_t column=0; column<recordLength; column++)
+                {
+                    block[column*BLOCK_ROWS + blockRowCount] = sample[column];
+                }
+                ring.release();
+                if(++blockRowCount == BLOCK_ROWS) writeBlock();
+            }
+
+            if(isStopping) break;
+            // polling keeps the producer free of any wake up call
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(blockRowCount > 0) writeBlock();
+    }
+
+    void writeBlock()
+    {
+        stateBlockHeader blockHeader = {blockRowCount, 0};
+        fwrite(&blockHeader, sizeof(blockHeader), 1, file);
+        for(size_t column=0; column<ring.recordLength(); column++)
+        {
+            fwrite(&block[column*BLOCK_ROWS], sizeof(double), blockRowCount, file);
+        }
+        rows += blockRowCount;
+        blockRowCount = 0;
+    }
+
+    FILE *file = NULL;
+    stateFileHeader header;
+    std::vector<stateLogField> fields;
+    spscRing<double> ring;
+    std::thread writer;
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> dropped{0};
+
+    // writer thread only
+    std::vector<double> block; // column major, BLOCK_ROWS rows
+    uint32_t blockRowCount = 0;
+    uint64_t rows = 0;
+};
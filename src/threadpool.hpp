@@ -0,0 +1,185 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include <thread>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Plain function pointer + argument. Avoids std::function allocations on the per step path.
+struct poolTask
+{
+    void (*fcn)(void *arg);
+    void *arg;
+};
+
+class workStealingPool
+{
+    // Persistent pool of worker threads. Each worker owns a task queue.
+    // Tasks are distributed round robin. Idle workers take from the front of their own queue
+    // and steal from the back of the other queues before going to sleep.
+    // The queues are fixed capacity rings so that submit never allocates. Size them with the number of
+    //  tasks that can be in flight at once (one per block that steps in the pool)
+
+    public:
+
+    explicit workStealingPool(unsigned workerCount, unsigned taskCapacity = 1)
+    {
+        if(workerCount == 0) workerCount = 1;
+        for(unsigned index=0; index<workerCount; index++)
+        {
+            queues.push_back(std::make_unique<workerQueue>());
+            queues.back()->reserve(taskCapacity);
+        }
+        for(unsigned index=0; index<workerCount; index++)
+        {
+            workers.emplace_back(&workStealingPool::workerLoop, this, index);
+        }
+    }
+
+    ~workStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> locker(sleepMut);
+            stop = true;
+        }
+        sleepCv.notify_all();
+        for(auto &worker: workers)
+        {
+            if(worker.joinable()) worker.join();
+        }
+    }
+
+    // Grows every queue to hold taskCapacity tasks. Allocates, call it at init (mdlStart) and not while tasks are queued
+    void reserve(unsigned taskCapacity)
+    {
+        for(auto &queue: queues)
+        {
+            std::lock_guard<std::mutex> queueLocker(queue->mut);
+            queue->reserve(taskCapacity);
+        }
+    }
+
+    void submit(poolTask task)
+    {
+        unsigned queueIndex = nextQueue.fetch_add(1) % queues.size();
+        {
+            // pending is raised under sleepMut so that a worker cannot miss the wake up.
+            // it is raised before the task is visible, so a worker that takes the task right away never takes it below 0.
+            // the push happens under sleepMut too, so a woken worker always finds the task
+            std::lock_guard<std::mutex> locker(sleepMut);
+            std::lock_guard<std::mutex> queueLocker(queues[queueIndex]->mut);
+            if(queues[queueIndex]->pushBack(task))
+            {
+                pending++;
+                queueIndex = invalidQueue;
+            }
+        }
+        if(queueIndex == invalidQueue)
+        {
+            sleepCv.notify_one();
+        }
+        else
+        {
+            // more tasks in flight than reserved. run it here rather than growing the ring on the per step path
+            task.fcn(task.arg);
+        }
+    }
+
+    unsigned size()
+    {
+        return static_cast<unsigned>(workers.size());
+    }
+
+    private:
+
+    static constexpr unsigned invalidQueue = ~0u;
+
+    struct workerQueue
+    {
+        // ring buffer. tasks[head] is the front, count tasks follow it (wrapping around)
+        std::mutex mut;
+        std::vector<poolTask> tasks;
+        size_t head = 0;
+        size_t count = 0;
+
+        void reserve(unsigned capacity)
+        {
+            if(capacity <= tasks.size()) return;
+            std::vector<poolTask> grown(capacity);
+            for(size_t index=0; index<count; index++) grown[index] = tasks[(head + index) % tasks.size()];
+            tasks.swap(grown);
+            head = 0;
+        }
+
+        bool pushBack(poolTask task)
+        {
+            if(count == tasks.size()) return false;
+            tasks[(head + count) % tasks.size()] = task;
+            count++;
+            return true;
+        }
+
+        bool popFront(poolTask &task)
+        {
+            if(count == 0) return false;
+            task = tasks[head];
+            head = (head + 1) % tasks.size();
+            count--;
+            return true;
+        }
+
+        bool popBack(poolTask &task)
+        {
+            if(count == 0) return false;
+            task = tasks[(head + count - 1) % tasks.size()];
+            count--;
+            return true;
+        }
+    };
+
+    bool popLocal(unsigned index, poolTask &task)
+    {
+        std::lock_guard<std::mutex> locker(queues[index]->mut);
+        return queues[index]->popFront(task);
+    }
+
+    bool steal(unsigned thief, poolTask &task)
+    {
+        for(unsigned offset=1; offset<queues.size(); offset++)
+        {
+            unsigned victim = (thief + offset) % queues.size();
+            std::lock_guard<std::mutex> locker(queues[victim]->mut);
+            if(queues[victim]->popBack(task)) return true;
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned index)
+    {
+        while(1)
+        {
+            poolTask task;
+            if(popLocal(index, task) || steal(index, task))
+            {
+                pending--;
+                task.fcn(task.arg);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> locker(sleepMut);
+            sleepCv.wait(locker, [this](){ return stop || pending > 0;});
+            if(stop && pending == 0) break;
+        }
+    }
+
+    std::vector<std::unique_ptr<workerQueue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMut;
+    std::condition_variable sleepCv;
+    std::atomic<unsigned> pending{0}; // submitted tasks not yet taken by a worker
+    std::atomic<unsigned> nextQueue{0};
+    bool stop = false;
+};
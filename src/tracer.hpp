@@ -0,0 +1,198 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+// CHROME TRACE
+// Timestamped begin/end/instant events from every thread that touches a block, written as a Chrome trace
+//  (JSON object format) that chrome://tracing and ui.perfetto.dev open directly.
+// Every thread appends to its own fixed size buffer, so recording takes no lock and never allocates.
+// Event names are string literals (only the pointer is stored).
+
+struct traceEvent
+{
+    const char *name;
+    uint64_t timestamp; // ns since the trace was started
+    int32_t arg; // block instance (or window) index. -1 for none
+    char phase; // 'B' begin, 'E' end, 'i' instant
+};
+
+class traceRecorder
+{
+    public:
+
+    static traceRecorder &global()
+    {
+        static traceRecorder recorder;
+        return recorder;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled.load(std::memory_order_acquire);
+    }
+
+    // First call wins. Later calls (other blocks) join the running trace
+    void start(const std::string &tracePath)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if(enabled) return;
+        path = tracePath;
+        origin = std::chrono::steady_clock::now();
+        enabled.store(true, std::memory_order_release);
+    }
+
+    void begin(const char *name, int arg = -1)
+    {
+        if(isEnabled()) add(name, 'B', arg);
+    }
+
+    void end(const char *name, int arg = -1)
+    {
+        if(isEnabled()) add(name, 'E', arg);
+    }
+
+    void instant(const char *name, int arg = -1)
+    {
+        if(isEnabled()) add(name, 'i', arg);
+    }
+
+    // Name of the calling thread in the trace viewer
+    void setThreadName(const char *name)
+    {
+        if(!isEnabled()) return;
+        traceBuffer *buffer = localBuffer();
+        if(buffer) buffer->name = name;
+    }
+
+    // Writes the trace file and ends the session. Call only once all the traced threads are idle or stopped.
+    // Returns false when the file could not be written. droppedEvents tells how many events did not fit
+    bool stop(uint64_t &droppedEvents)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        droppedEvents = 0;
+        if(!enabled) return true;
+        enabled.store(false, std::memory_order_release);
+
+        bool isWritten = write(droppedEvents);
+        buffers.clear();
+        session.fetch_add(1, std::memory_order_release); // threads register a new buffer in the next trace
+        return isWritten;
+    }
+
+    private:
+    static constexpr size_t BUFFER_EVENTS = 1 << 20; // per thread, 24 MB
+
+    struct traceBuffer
+    {
+        std::vector<traceEvent> events;
+        std::atomic<size_t> count{0}; // published events
+        uint64_t dropped = 0;
+        uint32_t tid = 0;
+        const char *name = NULL;
+    };
+
+    traceBuffer *localBuffer()
+    {
+        thread_local traceBuffer *buffer = NULL;
+        thread_local uint64_t bufferSession = 0;
+
+        uint64_t current = session.load(std::memory_order_acquire);
+        if(!buffer || bufferSession != current)
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            if(!enabled) return NULL;
+            auto newBuffer = std::make_unique<traceBuffer>();
+            newBuffer->events.resize(BUFFER_EVENTS);
+            newBuffer->tid = static_cast<uint32_t>(buffers.size() + 1);
+            buffer = newBuffer.get();
+            bufferSession = current;
+            buffers.push_back(std::move(newBuffer));
+        }
+        return buffer;
+    }
+
+    void add(const char *name, char phase, int arg)
+    {
+        uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - origin).count());
+        traceBuffer *buffer = localBuffer();
+        if(!buffer) return;
+
+        size_t index = buffer->count.load(std::memory_order_relaxed);
+        if(index == buffer->events.size())
+        {
+            buffer->dropped++;
+            return;
+        }
+        buffer->events[index] = {name, timestamp, arg, phase};
+        buffer->count.store(index + 1, std::memory_order_release);
+    }
+
+    bool write(uint64_t &droppedEvents)
+    {
+        FILE *file = fopen(path.c_str(), "w");
+        if(!file) return false;
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool isFirst = true;
+        for(auto &buffer: buffers)
+        {
+            droppedEvents += buffer->dropped;
+            if(buffer->name)
+            {
+                fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    isFirst ? "" : ",\n", buffer->tid, buffer->name);
+                isFirst = false;
+            }
+
+            size_t count = buffer->count.load(std::memory_order_acquire);
+            for(size_t index=0; index<count; index++)
+            {
+                const traceEvent &event = buffer->events[index];
+                fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", isFirst ? "" : ",\n",
+                    event.name, event.phase, event.timestamp/1000.0, buffer->tid);
+                if(event.phase == 'i') fprintf(file, ",\"s\":\"t\"");
+                if(event.arg >= 0) fprintf(file, ",\"args\":{\"index\":%d}", event.arg);
+                fprintf(file, "}");
+                isFirst = false;
+            }
+        }
+        fprintf(file, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", static_cast<unsigned long long>(droppedEvents));
+        return fclose(file) == 0;
+    }
+
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> session{1};
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<traceBuffer>> buffers;
+    std::string path;
+    std::chrono::steady_clock::time_point origin;
+};
+
+class traceScope
+{
+    // Begin event now, end event when the scope is left
+    public:
+    traceScope(const char *scopeName, int scopeArg = -1) : name(scopeName), arg(scopeArg)
+    {
+        isActive = traceRecorder::global().isEnabled();
+        if(isActive) traceRecorder::global().begin(name, arg);
+    }
+
+    ~traceScope()
+    {
+        if(isActive) traceRecorder::global().end(name, arg);
+    }
+
+    private:
+    const char *name;
+    int arg;
+    bool isActive;
+};
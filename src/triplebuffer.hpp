@@ -0,0 +1,56 @@
+// Copyright 2022-2023 The MathWorks, Inc.
+#pragma once
+#include <atomic>
+#include <stdint.h>
+
+template <typename T>
+class tripleBuffer
+{
+    // Lock free handoff between a single producer and a single consumer.
+    // The producer always owns a slot to write into and the consumer always owns the latest complete slot.
+    // The third (middle) slot is swapped atomically, so neither side ever waits on the other.
+    // Intermediate states are dropped if the producer publishes faster than the consumer fetches.
+
+    public:
+
+    // Producer side
+    T &writeBuffer()
+    {
+        return slots[backIndex];
+    }
+
+    void publish()
+    {
+        uint8_t previous = middle.exchange(backIndex | FRESH_BIT, std::memory_order_acq_rel);
+        backIndex = previous & INDEX_MASK;
+    }
+
+    // Consumer side. Returns true when a newer slot was published since the last fetch
+    bool fetch()
+    {
+        if((middle.load(std::memory_order_acquire) & FRESH_BIT) == 0) return false;
+        uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX_MASK;
+        return true;
+    }
+
+    const T &readBuffer()
+    {
+        return slots[frontIndex];
+    }
+
+    // Direct access for sizing the slots before any producer/consumer activity
+    T &slot(unsigned index)
+    {
+        return slots[index];
+    }
+
+    private:
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    static constexpr uint8_t FRESH_BIT = 0x4;
+
+    T slots[3];
+    uint8_t backIndex = 0; // producer only
+    uint8_t frontIndex = 2; // consumer only
+    std::atomic<uint8_t> middle{1};
+};
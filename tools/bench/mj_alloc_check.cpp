@@ -0,0 +1,192 @@
+// Allocation check of the per step path of the core library (mj.cpp), i.e. what mdlUpdate and mdlOutputs call every sample:
+//  setControl, step and getSensors, with zoh and foh control interpolation, substeps and perf counters.
+// The parallel step cases go through a workStealingPool like parallelStep: stepInPool in mdlUpdate, joinPendingStep in mdlOutputs.
+// Every heap allocation of the process is counted while the steps run (malloc family interposed, operator new goes
+//  through malloc). Exits with 1 when any step allocated.
+//  mj_alloc_check [--steps N] [--substeps N] model.xml ...
+// Build with "make bench" from tools/ (linux, glibc)
+
+// Copyright 2022-2023 The MathWorks, Inc.
+
+#include "mj.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <errno.h>
+#include <iostream>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// ALLOCATION COUNTING -------------------------------------------------------------
+static std::atomic<bool> isCounting{false};
+static std::atomic<unsigned long long> allocationCount{0};
+
+static void countAllocation()
+{
+    if(isCounting.load(std::memory_order_relaxed)) allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+
+// the definitions in the executable take precedence over libc for every shared library (incl. libmujoco and libstdc++)
+void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    countAllocation();
+    *pointer = __libc_memalign(alignment, size);
+    return *pointer ? 0 : ENOMEM;
+}
+
+void free(void *pointer)
+{
+    __libc_free(pointer);
+}
+}
+
+// CHECK ---------------------------------------------------------------------------
+struct checkCase
+{
+    const char *name;
+    ctrlInterpolation interp;
+    unsigned substeps;
+    bool perfCounters;
+    bool portPointers; // step(uPtrs) like a block with non contiguous inputs. otherwise step(u)
+    bool parallelStep; // stepInPool and joinPendingStep on a pool sized like mdlStart does (parallelStep option)
+};
+
+static bool runCase(const std::string &model, const checkCase &config, unsigned steps)
+{
+    auto mi = std::make_shared<MujocoModelInstance>();
+    if(mi->initMdl(model, false, false) != 0 || mi->initData() != 0)
+    {
+        std::cerr << "Unable to initialize model " << model << "\n";
+        return false;
+    }
+    mi->interp = config.interp;
+    mi->substeps = config.substeps;
+    mi->perf.enabled = config.perfCounters;
+
+    // one block steps in the pool. mdlStart reserves one task per block
+    std::unique_ptr<workStealingPool> stepPool;
+    if(config.parallelStep) stepPool = std::make_unique<workStealingPool>(2, 1);
+
+    std::vector<double> u(mi->ci.count, 0);
+    std::vector<const double *> uPtrs(u.size());
+    for(size_t index=0; index<u.size(); index++) uPtrs[index] = &u[index];
+    std::vector<double> y(mi->si.scalarCount + 1, 0);
+    unsigned nu = static_cast<unsigned>(u.size());
+
+    // first steps may size lazily allocated buffers. they are not part of the steady state
+    const unsigned warmupSteps = 10;
+    for(unsigned step=0; step<warmupSteps+steps; step++)
+    {
+        if(step == warmupSteps)
+        {
+            allocationCount = 0;
+            isCounting = true;
+        }
+        double value = std::sin(0.01*step);
+        for(auto &control: u) control = value;
+
+        // mdlUpdate
+        if(stepPool)
+        {
+            if(config.portPointers) mi->stepInPool(*stepPool, uPtrs.data(), nu);
+            else mi->stepInPool(*stepPool, u.data(), nu);
+        }
+        else if(config.portPointers) mi->step(uPtrs.data(), nu);
+        else mi->step(u.data(), nu);
+
+        // mdlOutputs
+        mi->joinPendingStep(-1);
+        mi->getSensors(y.data());
+    }
+    isCounting = false;
+    stepPool.reset();
+    unsigned long long allocations = allocationCount.load();
+
+    printf("%-40s %-24s %8u steps  %llu allocations\n", model.c_str(), config.name, steps, allocations);
+    return allocations == 0;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned steps = 1000;
+    unsigned substeps = 4;
+    std::vector<std::string> models;
+    for(int index=1; index<argc; index++)
+    {
+        std::string arg = argv[index];
+        if(arg == "--steps" && index+1 < argc) steps = static_cast<unsigned>(atoi(argv[++index]));
+        else if(arg == "--substeps" && index+1 < argc) substeps = static_cast<unsigned>(std::max(1, atoi(argv[++index])));
+        else if(arg.rfind("--", 0) == 0)
+        {
+            fprintf(stderr, "Usage: mj_alloc_check [--steps N] [--substeps N] model.xml ...\n");
+            return 2;
+        }
+        else models.push_back(arg);
+    }
+    if(models.empty() || steps == 0)
+    {
+        fprintf(stderr, "Usage: mj_alloc_check [--steps N] [--substeps N] model.xml ...\n");
+        return 2;
+    }
+
+    const checkCase cases[] = {
+        {"zoh", CTRL_ZOH, 1, false, false, false},
+        {"zoh port pointers", CTRL_ZOH, 1, false, true, false},
+        {"foh substeps", CTRL_FOH, substeps, false, false, false},
+        {"zoh substeps perf", CTRL_ZOH, substeps, true, true, false},
+        {"parallel step", CTRL_ZOH, 1, false, false, true},
+        {"parallel step foh perf", CTRL_FOH, substeps, true, true, true},
+    };
+
+    int status = 0;
+    for(auto &model: models)
+    {
+        for(auto &config: cases)
+        {
+            if(!runCase(model, config, steps)) status = 1;
+        }
+    }
+    glfwTerminate();
+    return status;
+}
@@ -0,0 +1,727 @@
+// Standalone benchmark of the core library (mj.cpp) without MATLAB.
+// Drives the call sequence of the S-Function (mj_sfun.cpp) with a rendering thread like renderingThreadFcn:
+//  start (mdlStart), outputs and update of every block per sample (mdlOutputs/mdlUpdate) and terminate (mdlTerminate).
+// Reports steps/s, per phase latency percentiles, memory and rendering thread CPU usage. See usage() for the options.
+// Build with "make bench" from tools/
+
+// Copyright 2022-2023 The MathWorks, Inc.
+
+#include "mj.hpp"
+#include "threadpool.hpp"
+#include "tracer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+typedef enum
+{
+    WINDOW_NONE=0,
+    WINDOW_LOCAL,
+    WINDOW_GLOBAL
+}windowModeEnum;
+
+struct benchConfig
+{
+    std::vector<std::string> models;
+    std::vector<unsigned> instanceCounts = {1};
+    unsigned steps = 2000;
+    unsigned warmupSteps = 100; // excluded from the statistics
+    double idleSeconds = 1.0; // rendering thread CPU is sampled while no camera is requested
+    double controlAmplitude = 0; // controls follow amplitude*sin(2*pi*t). 0 - zero controls
+
+    // camera setup (same meaning as the block options)
+    bool cameras = true;
+    double cameraSampleTime = 0.02;
+    bool cameraAtlas = false;
+    bool cameraAsyncReadback = false;
+    bool cameraMetricDepth = false;
+    bool cameraPointCloud = false;
+    bool cameraMatlabLayout = false;
+    bool cameraPipeline = false;
+    bool cameraSkipUnchanged = false;
+    double cameraChangeTolerance = 0;
+    glBackendType backend = defaultGlBackend();
+    std::string backendName = "default";
+
+    unsigned substeps = 1;
+    ctrlInterpolation interp = CTRL_ZOH; // controlInterpolation option
+    unsigned parallelStep = 0; // worker threads. 0 - step in the calling thread
+
+    windowModeEnum window = WINDOW_NONE;
+    unsigned windowInstanceBudget = 0;
+    double fps = 30;
+
+    bool perfCounters = false; // perfCounters option. summary of the first block
+    std::string traceFile; // traceFile option. empty - off
+
+    std::string jsonPath; // "-" for stdout
+};
+
+// LATENCY STATISTICS ---------------------------------------------------------
+
+class phaseStats
+{
+    // Samples are kept in full (preallocated) and sorted once at the end. The hot path only appends
+    public:
+    void reserve(size_t count)
+    {
+        samples.reserve(count);
+    }
+
+    void add(std::chrono::steady_clock::duration elapsed)
+    {
+        if(samples.size() < samples.capacity())
+        {
+            samples.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+        }
+    }
+
+    void finish()
+    {
+        std::sort(samples.begin(), samples.end());
+    }
+
+    size_t count() const
+    {
+        return samples.size();
+    }
+
+    double percentile(double p) const
+    {
+        if(samples.empty()) return 0;
+        size_t index = static_cast<size_t>(std::ceil(p/100.0*samples.size()));
+        return samples[(index > 0) ? index-1 : 0];
+    }
+
+    double mean() const
+    {
+        if(samples.empty()) return 0;
+        double sum = 0;
+        for(double sample: samples) sum += sample;
+        return sum/samples.size();
+    }
+
+    double max() const
+    {
+        return samples.empty() ? 0 : samples.back();
+    }
+
+    private:
+    std::vector<double> samples; // microseconds
+};
+
+// PROCESS AND THREAD RESOURCES ---------------------------------------------------------
+
+static double residentMegabytes()
+{
+#ifdef __linux__
+    std::ifstream statm("/proc/self/statm");
+    long pages = 0, residentPages = 0;
+    statm >> pages >> residentPages;
+    return static_cast<double>(residentPages)*sysconf(_SC_PAGESIZE)/(1024.0*1024.0);
+#else
+    return -1;
+#endif
+}
+
+static double peakResidentMegabytes()
+{
+#ifdef __linux__
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss/1024.0; // kilobytes
+#else
+    return -1;
+#endif
+}
+
+static double threadCpuSeconds(std::thread &thread)
+{
+    // valid only while the thread is running
+#ifdef __linux__
+    clockid_t clockId;
+    if(!thread.joinable() || pthread_getcpuclockid(thread.native_handle(), &clockId) != 0) return -1;
+    struct timespec now;
+    clock_gettime(clockId, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
+#else
+    return -1;
+#endif
+}
+
+// STAND-IN FOR THE S-FUNCTION ---------------------------------------------------------
+
+struct benchBlock
+{
+    // one MuJoCo block. Buffers play the role of the block's ports
+    std::shared_ptr<MujocoModelInstance> mi;
+    int index = 0; // miIndex of the S-Function. tags the trace events
+    std::vector<double> u;
+    std::vector<double> y;
+    std::vector<uint8_t> rgb;
+    std::vector<float> depth;
+    std::vector<float> points;
+};
+
+struct benchRun
+{
+    std::vector<benchBlock> blocks;
+    std::vector<std::shared_ptr<MujocoGUI>> mg;
+
+    std::thread renderingThread;
+    std::atomic<bool> signalThreadExit = false;
+    eventSignal renderWakeup;
+    binarySemp renderingReady; // released once cameras and windows are initialized
+    guiErrCodes renderingInitErr = NO_ERR;
+
+    std::unique_ptr<workStealingPool> stepPool;
+
+    phaseStats sensors; // getSensors
+    phaseStats cameraWait; // camera request until the frame is available (sync) or the previous frame is collected (pipelined)
+    phaseStats cameraCopy; // getCameraRGB/Depth/PointCloud
+    phaseStats step; // mdlUpdate. queueing only in parallel stepping mode
+    phaseStats stepJoin; // waiting for a deferred step in parallel stepping mode
+};
+
+static void renderingThreadFcn(benchRun *run)
+{
+    // same sequence as renderingThreadFcn in mj_sfun.cpp, on the same library calls. Windows get no input callbacks here
+    for(auto &block: run->blocks)
+    {
+        auto guiStatus = block.mi->initRenderingInThread();
+        if(guiStatus != NO_ERR) run->renderingInitErr = guiStatus;
+    }
+    for(auto &gui: run->mg)
+    {
+        auto guiStatus = gui->initInThread();
+        if(guiStatus != NO_ERR) run->renderingInitErr = guiStatus;
+    }
+    run->renderingReady.release();
+
+    while(1)
+    {
+        auto nextWindowDeadline = renderWindowsInThread(run->mg);
+        for(size_t index=0; index<run->blocks.size(); index++)
+        {
+            run->blocks[index].mi->serveCameraRequestInThread(static_cast<int>(index));
+        }
+        if(run->signalThreadExit == true) break;
+
+        if(nextWindowDeadline == std::chrono::steady_clock::time_point::max())
+        {
+            run->renderWakeup.wait();
+        }
+        else
+        {
+            run->renderWakeup.waitUntil(nextWindowDeadline);
+        }
+    }
+
+    for(auto &gui: run->mg)
+    {
+        gui->releaseInThread();
+    }
+    for(auto &block: run->blocks)
+    {
+        block.mi->releaseRenderingInThread();
+    }
+
+    glfwTerminate();
+}
+
+static bool startBlocks(benchRun &run, const benchConfig &config, const std::string &model, unsigned instanceCount)
+{
+    // mdlStart of every block
+    for(unsigned index=0; index<instanceCount; index++)
+    {
+        benchBlock block;
+        block.index = static_cast<int>(run.blocks.size());
+        block.mi = std::make_shared<MujocoModelInstance>();
+        auto &mi = block.mi;
+        mi->offscreenBackend = config.backend;
+        mi->cameraAtlas = config.cameraAtlas;
+        mi->cameraAsyncReadback = config.cameraAsyncReadback;
+        mi->cameraMetricDepth = config.cameraMetricDepth;
+        mi->cameraPointCloud = config.cameraPointCloud;
+        mi->cameraMatlabLayout = config.cameraMatlabLayout;
+        mi->cameraSkipUnchanged = config.cameraSkipUnchanged;
+        mi->cameraChangeTolerance = config.cameraChangeTolerance;
+        mi->perf.enabled = config.perfCounters;
+
+        if(mi->initMdl(model, config.cameras, false) != 0)
+        {
+            std::cerr << "Unable to initialize model " << model << "\n";
+            return false;
+        }
+        if(mi->initData() != 0)
+        {
+            std::cerr << "Unable to initialize model instance data\n";
+            return false;
+        }
+        mi->cameraRenderInterval = config.cameraSampleTime;
+        mi->substeps = config.substeps;
+        mi->interp = config.interp;
+        if(config.cameraPipeline && mi->enableCameraPipeline() != 0)
+        {
+            std::cerr << "Unable to allocate pipelined camera data\n";
+            return false;
+        }
+
+        if(config.window == WINDOW_LOCAL || (config.window == WINDOW_GLOBAL && run.mg.empty()))
+        {
+            auto gui = std::make_shared<MujocoGUI>();
+            if(gui->init(mi, MJ_WINDOW) != NO_ERR)
+            {
+                std::cerr << "Unable to initialize GUI\n";
+                return false;
+            }
+            gui->renderInterval = std::chrono::microseconds{static_cast<long long>(1e6/config.fps)};
+            gui->instanceBudget = config.windowInstanceBudget;
+            run.mg.push_back(gui);
+        }
+        if(config.window != WINDOW_NONE) run.mg.back()->addMi(mi);
+
+        block.u.assign(mi->ci.count, 0);
+        block.y.assign(mi->si.scalarCount + 1, 0);
+        run.blocks.push_back(std::move(block));
+    }
+
+    if(config.parallelStep)
+    {
+        run.stepPool = std::make_unique<workStealingPool>(config.parallelStep, static_cast<unsigned>(run.blocks.size()));
+    }
+
+    // the S-Function starts the rendering thread in the first mdlUpdate. Here it is started up front,
+    //  so that GL initialization is reported separately and camera buffers can be sized
+    run.renderingThread = std::thread(renderingThreadFcn, &run);
+    run.renderingReady.acquire();
+
+    for(auto &block: run.blocks)
+    {
+        block.rgb.resize(block.mi->cami.rgbLength);
+        block.depth.resize(block.mi->cami.depthLength);
+        if(config.cameraPointCloud) block.points.resize(3*block.mi->cami.depthLength);
+    }
+    return true;
+}
+
+static void blockOutputs(benchRun &run, benchBlock &block, bool isMeasured)
+{
+    // mdlOutputs
+    using clock = std::chrono::steady_clock;
+    auto &miTemp = block.mi;
+
+    auto joinStart = clock::now();
+    bool wasPending = miTemp->joinPendingStep(block.index);
+    if(isMeasured && wasPending) run.stepJoin.add(clock::now() - joinStart);
+
+    auto sensorStart = clock::now();
+    size_t index = miTemp->getSensors(block.y.data());
+    block.y[index] = static_cast<double>(miTemp->si.count);
+    if(isMeasured) run.sensors.add(clock::now() - sensorStart);
+
+    auto cameraStart = clock::now();
+    cameraSampleStatus cameraStatus = miTemp->requestCameraSample(run.renderWakeup, block.index);
+    if(isMeasured && cameraStatus != CAMERA_NOT_DUE) run.cameraWait.add(clock::now() - cameraStart);
+
+    if(cameraStatus == CAMERA_COLLECTED)
+    {
+        auto copyStart = clock::now();
+        float *points = block.points.empty() ? nullptr : block.points.data();
+        bool isCopied = miTemp->copyCameraFrame(block.rgb.data(), block.depth.data(), points, block.index);
+        if(isMeasured && isCopied) run.cameraCopy.add(clock::now() - copyStart);
+    }
+}
+
+static void blockUpdate(benchRun &run, benchBlock &block, double amplitude, bool isMeasured)
+{
+    // mdlUpdate
+    using clock = std::chrono::steady_clock;
+    auto &miTemp = block.mi;
+
+    if(amplitude != 0)
+    {
+        double value = amplitude*std::sin(2*mjPI*miTemp->get_d()->time);
+        std::fill(block.u.begin(), block.u.end(), value);
+    }
+
+    auto stepStart = clock::now();
+    if(run.stepPool)
+    {
+        miTemp->stepInPool(*run.stepPool, block.u.data(), static_cast<unsigned>(block.u.size()));
+    }
+    else
+    {
+        miTemp->step(block.u.data(), static_cast<unsigned>(block.u.size()));
+    }
+    if(isMeasured) run.step.add(clock::now() - stepStart);
+}
+
+static void terminateBlocks(benchRun &run, std::string &perfSummary)
+{
+    // mdlTerminate
+    for(auto &block: run.blocks)
+    {
+        block.mi->quiesce();
+    }
+    run.signalThreadExit = true;
+    run.renderWakeup.notify();
+    if(run.renderingThread.joinable()) run.renderingThread.join();
+    if(!run.blocks.empty() && run.blocks[0].mi->perf.enabled) perfSummary = run.blocks[0].mi->perf.summary();
+    run.stepPool.reset();
+    run.mg.clear();
+    run.blocks.clear();
+}
+
+// REPORT ---------------------------------------------------------
+
+struct benchResult
+{
+    std::string model;
+    unsigned instances = 0;
+    unsigned steps = 0;
+    unsigned cameraCount = 0;
+    unsigned long long cameraSkips = 0;
+    int renderingInitErr = 0;
+    double startSeconds = 0;
+    double runSeconds = 0;
+    double terminateSeconds = 0;
+    double simulatedSeconds = 0;
+    double residentMB = 0;
+    double peakResidentMB = 0;
+    double renderCpuPercent = -1;
+    double idleRenderCpuPercent = -1;
+    std::string perfSummary; // perfCounters of the first block
+};
+
+static std::string jsonString(const std::string &text)
+{
+    std::string out = "\"";
+    for(char c: text)
+    {
+        if(c == '"' || c == '\\') out += '\\';
+        if(static_cast<unsigned char>(c) < 0x20) continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void jsonPhase(std::ostream &out, const char *name, const phaseStats &stats, bool isLast = false)
+{
+    out << jsonString(name) << ":{\"count\":" << stats.count()
+        << ",\"p50Us\":" << stats.percentile(50) << ",\"p99Us\":" << stats.percentile(99)
+        << ",\"meanUs\":" << stats.mean() << ",\"maxUs\":" << stats.max() << "}" << (isLast ? "" : ",");
+}
+
+static void writeJson(std::ostream &out, const benchConfig &config, const benchResult &result, const benchRun &run)
+{
+    double stepsPerSecond = (result.runSeconds > 0) ? result.steps*result.instances/result.runSeconds : 0;
+    out << "{\"model\":" << jsonString(result.model)
+        << ",\"instances\":" << result.instances
+        << ",\"steps\":" << result.steps
+        << ",\"cameras\":" << result.cameraCount
+        << ",\"config\":{\"cameraSampleTime\":" << (config.cameras ? config.cameraSampleTime : -1)
+        << ",\"cameraAtlas\":" << config.cameraAtlas
+        << ",\"cameraAsyncReadback\":" << config.cameraAsyncReadback
+        << ",\"depthMetric\":" << config.cameraMetricDepth
+        << ",\"pointCloud\":" << config.cameraPointCloud
+        << ",\"cameraLayoutMatlab\":" << config.cameraMatlabLayout
+        << ",\"cameraPipeline\":" << config.cameraPipeline
+        << ",\"cameraSkipUnchanged\":" << config.cameraSkipUnchanged
+        << ",\"glBackend\":" << jsonString(config.backendName)
+        << ",\"substeps\":" << config.substeps
+        << ",\"controlInterpolation\":" << jsonString(config.interp == CTRL_FOH ? "foh" : "zoh")
+        << ",\"parallelStep\":" << config.parallelStep
+        << ",\"window\":" << static_cast<int>(config.window)
+        << ",\"windowInstanceBudget\":" << config.windowInstanceBudget << "}"
+        << ",\"renderingInitErr\":" << result.renderingInitErr
+        << ",\"cameraSkips\":" << result.cameraSkips
+        << ",\"startSeconds\":" << result.startSeconds
+        << ",\"runSeconds\":" << result.runSeconds
+        << ",\"terminateSeconds\":" << result.terminateSeconds
+        << ",\"stepsPerSecond\":" << stepsPerSecond
+        << ",\"realTimeFactor\":" << ((result.runSeconds > 0) ? result.simulatedSeconds/result.runSeconds : 0)
+        << ",\"residentMB\":" << result.residentMB
+        << ",\"peakResidentMB\":" << result.peakResidentMB
+        << ",\"renderCpuPercent\":" << result.renderCpuPercent
+        << ",\"idleRenderCpuPercent\":" << result.idleRenderCpuPercent
+        << ",\"phases\":{";
+    jsonPhase(out, "sensors", run.sensors);
+    jsonPhase(out, "cameraWait", run.cameraWait);
+    jsonPhase(out, "cameraCopy", run.cameraCopy);
+    jsonPhase(out, "step", run.step);
+    jsonPhase(out, "stepJoin", run.stepJoin, true);
+    out << "}}\n";
+}
+
+static void printPhase(const char *name, const phaseStats &stats)
+{
+    if(stats.count() == 0) return;
+    printf("  %-11s %9zu samples  p50 %10.1f us  p99 %10.1f us  mean %10.1f us  max %10.1f us\n",
+        name, stats.count(), stats.percentile(50), stats.percentile(99), stats.mean(), stats.max());
+}
+
+static void printReport(const benchResult &result, const benchRun &run)
+{
+    double stepsPerSecond = (result.runSeconds > 0) ? result.steps*result.instances/result.runSeconds : 0;
+    printf("%s  instances %u  cameras %u\n", result.model.c_str(), result.instances, result.cameraCount);
+    if(result.renderingInitErr != NO_ERR)
+    {
+        printf("  rendering init failed. error code %d\n", result.renderingInitErr);
+    }
+    printf("  start %.3f s  run %.3f s  terminate %.3f s\n", result.startSeconds, result.runSeconds, result.terminateSeconds);
+    printf("  %.0f steps/s  real time factor %.2f\n", stepsPerSecond,
+        (result.runSeconds > 0) ? result.simulatedSeconds/result.runSeconds : 0);
+    printPhase("sensors", run.sensors);
+    printPhase("cameraWait", run.cameraWait);
+    printPhase("cameraCopy", run.cameraCopy);
+    printPhase("step", run.step);
+    printPhase("stepJoin", run.stepJoin);
+    if(result.cameraSkips > 0) printf("  %llu unchanged camera renders skipped\n", result.cameraSkips);
+    printf("  resident %.1f MB  peak %.1f MB\n", result.residentMB, result.peakResidentMB);
+    printf("  rendering thread CPU %.1f %% (idle %.1f %%)\n", result.renderCpuPercent, result.idleRenderCpuPercent);
+    if(!result.perfSummary.empty()) printf("  perfCounters of the first block:\n%s", result.perfSummary.c_str());
+}
+
+// MAIN ---------------------------------------------------------
+
+static bool runBenchmark(const benchConfig &config, const std::string &model, unsigned instanceCount)
+{
+    using clock = std::chrono::steady_clock;
+    benchRun run;
+    benchResult result;
+    result.model = model;
+    result.instances = instanceCount;
+    result.steps = config.steps;
+
+    size_t sampleCount = static_cast<size_t>(config.steps)*instanceCount;
+    run.sensors.reserve(sampleCount);
+    run.cameraWait.reserve(sampleCount);
+    run.cameraCopy.reserve(sampleCount);
+    run.step.reserve(sampleCount);
+    run.stepJoin.reserve(sampleCount);
+
+    if(!config.traceFile.empty())
+    {
+        traceRecorder::global().start(config.traceFile);
+        traceRecorder::global().setThreadName("Simulink");
+    }
+
+    auto startTime = clock::now();
+    if(!startBlocks(run, config, model, instanceCount))
+    {
+        terminateBlocks(run, result.perfSummary);
+        uint64_t droppedEvents = 0;
+        traceRecorder::global().stop(droppedEvents);
+        return false;
+    }
+    result.startSeconds = std::chrono::duration<double>(clock::now() - startTime).count();
+    result.renderingInitErr = run.renderingInitErr;
+    result.cameraCount = config.cameras ? run.blocks[0].mi->cami.count : 0;
+
+    // rendering thread with windows open but no camera requests (e.g. a paused or slow simulation)
+    if(config.idleSeconds > 0)
+    {
+        double cpuStart = threadCpuSeconds(run.renderingThread);
+        std::this_thread::sleep_for(std::chrono::duration<double>(config.idleSeconds));
+        double cpuEnd = threadCpuSeconds(run.renderingThread);
+        if(cpuStart >= 0) result.idleRenderCpuPercent = 100*(cpuEnd - cpuStart)/config.idleSeconds;
+    }
+
+    // Simulink single tasking order. outputs of all blocks, then update of all blocks
+    for(unsigned step=0; step<config.warmupSteps; step++)
+    {
+        for(auto &block: run.blocks) blockOutputs(run, block, false);
+        for(auto &block: run.blocks) blockUpdate(run, block, config.controlAmplitude, false);
+    }
+
+    double simStart = run.blocks[0].mi->get_d()->time;
+    double cpuStart = threadCpuSeconds(run.renderingThread);
+    auto runStart = clock::now();
+    for(unsigned step=0; step<config.steps; step++)
+    {
+        for(auto &block: run.blocks) blockOutputs(run, block, true);
+        for(auto &block: run.blocks) blockUpdate(run, block, config.controlAmplitude, true);
+    }
+    for(auto &block: run.blocks) block.mi->joinPendingStep(block.index);
+    result.runSeconds = std::chrono::duration<double>(clock::now() - runStart).count();
+    double cpuEnd = threadCpuSeconds(run.renderingThread);
+    if(cpuStart >= 0 && result.runSeconds > 0) result.renderCpuPercent = 100*(cpuEnd - cpuStart)/result.runSeconds;
+    result.simulatedSeconds = run.blocks[0].mi->get_d()->time - simStart;
+    result.residentMB = residentMegabytes();
+    for(auto &block: run.blocks) result.cameraSkips += block.mi->cameraSkipCount.load();
+
+    auto terminateTime = clock::now();
+    terminateBlocks(run, result.perfSummary);
+    result.terminateSeconds = std::chrono::duration<double>(clock::now() - terminateTime).count();
+
+    uint64_t droppedEvents = 0;
+    if(!traceRecorder::global().stop(droppedEvents)) std::cerr << "Unable to write " << config.traceFile << "\n";
+    else if(droppedEvents > 0) std::cerr << "Trace buffers were full. " << droppedEvents << " events were dropped\n";
+    result.peakResidentMB = peakResidentMegabytes();
+
+    run.sensors.finish();
+    run.cameraWait.finish();
+    run.cameraCopy.finish();
+    run.step.finish();
+    run.stepJoin.finish();
+
+    printReport(result, run);
+    if(config.jsonPath == "-")
+    {
+        writeJson(std::cout, config, result, run);
+    }
+    else if(!config.jsonPath.empty())
+    {
+        std::ofstream json(config.jsonPath, std::ios::app); // one line per run. results accumulate across invocations
+        writeJson(json, config, result, run);
+    }
+    return true;
+}
+
+static void usage()
+{
+    printf(
+        "usage: mj_bench [options] model.xml [model.xml ...]\n"
+        "  --instances N[,N...]      blocks per run. one run per count (default 1)\n"
+        "  --steps N                 measured samples per block (default 2000)\n"
+        "  --warmup N                samples before measuring (default 100)\n"
+        "  --idle SECONDS            rendering thread idle CPU sampling time (default 1, 0 to skip)\n"
+        "  --control-amplitude A     controls follow A*sin(2*pi*t) (default 0)\n"
+        "  --no-cameras              do not render the model's cameras\n"
+        "  --camera-sample-time T    camera sample time in seconds (default 0.02)\n"
+        "  --camera-atlas            cameraAtlas option\n"
+        "  --camera-async-readback   cameraAsyncReadback option\n"
+        "  --depth-metric            depthOutput=metric option\n"
+        "  --point-cloud             pointCloud output\n"
+        "  --camera-layout-matlab    cameraLayout=matlab option\n"
+        "  --camera-pipeline         cameraPipeline option\n"
+        "  --camera-skip-unchanged   cameraSkipUnchanged option\n"
+        "  --camera-change-tolerance TOL  cameraChangeTolerance option\n"
+        "  --gl-backend NAME         glfw, egl or osmesa (default MUJOCO_GL or glfw)\n"
+        "  --substeps N              substeps option\n"
+        "  --control-interpolation zoh|foh  controlInterpolation option (default zoh)\n"
+        "  --parallel-step THREADS   parallelStep option with a pool of THREADS workers\n"
+        "  --window none|local|global  rendering type (default none)\n"
+        "  --fps F                   window frame rate (default 30)\n"
+        "  --window-budget N         windowInstanceBudget option\n"
+        "  --perf-counters           perfCounters option (summary of the first block)\n"
+        "  --trace FILE              traceFile option\n"
+        "  --json FILE               append one JSON line per run to FILE (- for stdout)\n");
+}
+
+static bool parseArguments(int argc, char **argv, benchConfig &config)
+{
+    for(int index=1; index<argc; index++)
+    {
+        std::string arg = argv[index];
+        bool hasValue = (index+1 < argc);
+        std::string value = hasValue ? argv[index+1] : "";
+
+        if(arg == "--help" || arg == "-h") return false;
+        else if(arg == "--no-cameras") config.cameras = false;
+        else if(arg == "--camera-atlas") config.cameraAtlas = true;
+        else if(arg == "--camera-async-readback") config.cameraAsyncReadback = true;
+        else if(arg == "--depth-metric") config.cameraMetricDepth = true;
+        else if(arg == "--point-cloud") config.cameraPointCloud = true;
+        else if(arg == "--camera-layout-matlab") config.cameraMatlabLayout = true;
+        else if(arg == "--camera-pipeline") config.cameraPipeline = true;
+        else if(arg == "--camera-skip-unchanged") config.cameraSkipUnchanged = true;
+        else if(arg == "--perf-counters") config.perfCounters = true;
+        else if(arg.compare(0, 2, "--") == 0)
+        {
+            if(!hasValue)
+            {
+                fprintf(stderr, "%s needs a value\n", arg.c_str());
+                return false;
+            }
+            index++;
+            if(arg == "--instances")
+            {
+                config.instanceCounts.clear();
+                std::stringstream list(value);
+                std::string count;
+                while(std::getline(list, count, ','))
+                {
+                    if(atoi(count.c_str()) > 0) config.instanceCounts.push_back(atoi(count.c_str()));
+                }
+                if(config.instanceCounts.empty()) return false;
+            }
+            else if(arg == "--steps") config.steps = static_cast<unsigned>(atoi(value.c_str()));
+            else if(arg == "--warmup") config.warmupSteps = static_cast<unsigned>(atoi(value.c_str()));
+            else if(arg == "--idle") config.idleSeconds = atof(value.c_str());
+            else if(arg == "--control-amplitude") config.controlAmplitude = atof(value.c_str());
+            else if(arg == "--camera-sample-time") config.cameraSampleTime = atof(value.c_str());
+            else if(arg == "--camera-change-tolerance") config.cameraChangeTolerance = atof(value.c_str());
+            else if(arg == "--substeps") config.substeps = std::max(1, atoi(value.c_str()));
+            else if(arg == "--parallel-step") config.parallelStep = static_cast<unsigned>(std::max(0, atoi(value.c_str())));
+            else if(arg == "--fps") config.fps = std::max(1.0, atof(value.c_str()));
+            else if(arg == "--window-budget") config.windowInstanceBudget = static_cast<unsigned>(std::max(0, atoi(value.c_str())));
+            else if(arg == "--json") config.jsonPath = value;
+            else if(arg == "--trace") config.traceFile = value;
+            else if(arg == "--gl-backend")
+            {
+                if(!parseGlBackend(value, config.backend))
+                {
+                    fprintf(stderr, "Unknown GL backend %s\n", value.c_str());
+                    return false;
+                }
+                config.backendName = value;
+            }
+            else if(arg == "--control-interpolation")
+            {
+                if(value == "zoh") config.interp = CTRL_ZOH;
+                else if(value == "foh") config.interp = CTRL_FOH;
+                else return false;
+            }
+            else if(arg == "--window")
+            {
+                if(value == "none") config.window = WINDOW_NONE;
+                else if(value == "local") config.window = WINDOW_LOCAL;
+                else if(value == "global") config.window = WINDOW_GLOBAL;
+                else return false;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown option %s\n", arg.c_str());
+                return false;
+            }
+        }
+        else config.models.push_back(arg);
+    }
+    return !config.models.empty() && config.steps > 0;
+}
+
+int main(int argc, char **argv)
+{
+    benchConfig config;
+    if(!parseArguments(argc, argv, config))
+    {
+        usage();
+        return 1;
+    }
+
+    int status = 0;
+    for(auto &model: config.models)
+    {
+        for(unsigned instanceCount: config.instanceCounts)
+        {
+            if(!runBenchmark(config, model, instanceCount)) status = 1;
+        }
+    }
+    return status;
+}
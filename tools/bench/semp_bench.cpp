@@ -0,0 +1,88 @@
+// Handoff latency of binarySemp (spin then park) against condvarBinarySemp (mutex and condition variable).
+// Two threads ping-pong through a pair of semaphores like mdlOutputs and the rendering thread do for a camera frame.
+// The responder optionally works for a fixed time before answering (a render), which shows the cost of parking.
+//  semp_bench [round trips] [work us ...]
+// Build with "make bench" from tools/
+
+// Copyright 2022-2023 The MathWorks, Inc.
+
+#include "semaphore.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock benchClock;
+
+static void busyWork(std::chrono::microseconds duration)
+{
+    auto end = benchClock::now() + duration;
+    while(benchClock::now() < end) {}
+}
+
+template <typename sempType>
+static std::vector<double> pingPong(unsigned roundTrips, std::chrono::microseconds work)
+{
+    sempType request;
+    sempType response;
+    std::vector<double> latency; // round trip minus work, microseconds
+    latency.reserve(roundTrips);
+
+    std::thread responder([&]()
+    {
+        for(unsigned index=0; index<roundTrips; index++)
+        {
+            request.acquire();
+            busyWork(work);
+            response.release();
+        }
+    });
+
+    for(unsigned index=0; index<roundTrips; index++)
+    {
+        auto start = benchClock::now();
+        request.release();
+        response.acquire();
+        double elapsed = std::chrono::duration<double, std::micro>(benchClock::now() - start).count();
+        latency.push_back(elapsed - work.count());
+    }
+    responder.join();
+
+    std::sort(latency.begin(), latency.end());
+    return latency;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    size_t index = static_cast<size_t>(p/100.0*(sorted.size()-1));
+    return sorted[index];
+}
+
+static void report(const char *name, unsigned workUs, const std::vector<double> &latency)
+{
+    double sum = 0;
+    for(double value: latency) sum += value;
+    printf("%-18s work %6u us  overhead p50 %8.2f us  p99 %8.2f us  mean %8.2f us\n", name, workUs,
+        percentile(latency, 50), percentile(latency, 99), sum/latency.size());
+}
+
+int main(int argc, char **argv)
+{
+    unsigned roundTrips = (argc > 1) ? static_cast<unsigned>(atoi(argv[1])) : 20000;
+    std::vector<unsigned> workList;
+    for(int index=2; index<argc; index++) workList.push_back(static_cast<unsigned>(atoi(argv[index])));
+    if(workList.empty()) workList = {0, 10, 100, 1000};
+    if(roundTrips == 0) roundTrips = 1;
+
+    for(unsigned workUs: workList)
+    {
+        // fewer round trips for long work, so that every case takes a similar time
+        unsigned count = (workUs > 100) ? std::max(100u, roundTrips/(workUs/10)) : roundTrips;
+        std::chrono::microseconds work(workUs);
+        report("condvarBinarySemp", workUs, pingPong<condvarBinarySemp>(count, work));
+        report("binarySemp", workUs, pingPong<binarySemp>(count, work));
+    }
+    return 0;
+}